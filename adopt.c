@@ -10,19 +10,40 @@
 #include <string.h>
 #include <stdio.h>
 #include <limits.h>
+#include <stdint.h>
+#include <errno.h>
+#include <locale.h>
+#include <math.h>
 #include <assert.h>
 
-#if defined(__sun) || defined(__illumos__)
-# include <alloca.h>
-#endif
-
 #include "adopt.h"
 
 #ifdef _WIN32
 # include <windows.h>
+# include <io.h>
 #else
 # include <fcntl.h>
+# include <unistd.h>
 # include <sys/ioctl.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+#endif
+
+#if defined(ADOPT_THREADS) && !defined(_WIN32)
+# include <pthread.h>
+#endif
+
+#if defined(__AVX2__)
+# include <immintrin.h>
+# define SCAN_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || \
+      (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+# include <emmintrin.h>
+# define SCAN_SSE2
+#endif
+
+#if defined(_MSC_VER) && (defined(SCAN_AVX2) || defined(SCAN_SSE2))
+# include <intrin.h>
 #endif
 
 #ifdef _MSC_VER
@@ -31,74 +52,573 @@
 # define INLINE(type) static inline type
 #endif
 
-#ifdef _MSC_VER
-# define alloca _alloca
+#if defined(__GNUC__) || defined(__clang__)
+# define NO_SANITIZE_ADDRESS __attribute__((no_sanitize_address))
+#else
+# define NO_SANITIZE_ADDRESS
 #endif
 
+#define spec_is_numeric(x) \
+	((x)->type >= ADOPT_TYPE_INT32 && \
+	 (x)->type <= ADOPT_TYPE_RATIO)
+
+#define spec_is_list(x) \
+	((x)->type >= ADOPT_TYPE_LIST && \
+	 (x)->type <= ADOPT_TYPE_BITMASK)
+
+#define spec_takes_value(x) \
+	((x)->type == ADOPT_TYPE_VALUE || \
+	 (x)->type == ADOPT_TYPE_VALUES || \
+	 (x)->type == ADOPT_TYPE_ENUM || \
+	 (x)->type == ADOPT_TYPE_SUBOPTS || \
+	 (x)->type == ADOPT_TYPE_KEY_VALUES || \
+	 spec_is_numeric(x) || \
+	 spec_is_list(x))
+
+#define spec_enum_values(x) \
+	(((x)->type == ADOPT_TYPE_ENUM || (x)->type == ADOPT_TYPE_BITMASK) ? \
+	 (const adopt_enum_value *)(x)->data : NULL)
+
+#define spec_subopts(x) \
+	((x)->type == ADOPT_TYPE_SUBOPTS ? \
+	 (const adopt_spec *)(x)->data : NULL)
+
+#define spec_is_subopt_type(x) \
+	((x)->type == ADOPT_TYPE_BOOL || \
+	 (x)->type == ADOPT_TYPE_SWITCH || \
+	 (x)->type == ADOPT_TYPE_ACCUMULATOR || \
+	 (x)->type == ADOPT_TYPE_VALUE || \
+	 (x)->type == ADOPT_TYPE_ENUM || \
+	 spec_is_numeric(x) || \
+	 spec_is_list(x))
+
+#define spec_takes_words(x) \
+	((x)->type == ADOPT_TYPE_WORDS || \
+	 (x)->type == ADOPT_TYPE_WORDS_UNTIL)
+
 #define spec_is_option_type(x) \
 	((x)->type == ADOPT_TYPE_BOOL || \
 	 (x)->type == ADOPT_TYPE_SWITCH || \
-	 (x)->type == ADOPT_TYPE_VALUE)
+	 spec_takes_value(x) || \
+	 spec_takes_words(x))
+
+#define INDEX_HASH_INIT  2166136261u
+#define INDEX_HASH(h, c) (((h) ^ (unsigned char)(c)) * 16777619u)
+
+/*
+ * An entry in the long name hash table.  Negated entries are keyed
+ * on the implicit "no-" prefix followed by the spec's name.
+ */
+typedef struct {
+	const adopt_spec *spec;
+	uint32_t hash;
+	size_t len;
+	unsigned int negated : 1;
+} index_name;
+
+/*
+ * The `ADOPT_USAGE_CHOICE` group that a spec belongs to: the position
+ * of its first spec, the number of specs in the group and the number
+ * of `ADOPT_TYPE_ARG`s among them.  A spec that is not part of a
+ * choice is a group of one, with no arguments to consume.
+ */
+typedef struct {
+	size_t start;
+	size_t len;
+	size_t args;
+} index_choice;
+
+/*
+ * An entry in the hash table of the keys that belong to a spec: the
+ * values of an `ADOPT_TYPE_ENUM` or `ADOPT_TYPE_BITMASK`, and the
+ * names of the sub-options of an `ADOPT_TYPE_SUBOPTS`.
+ */
+typedef struct {
+	const adopt_spec *spec;
+	const char *name;
+	const void *item;
+	uint32_t hash;
+	size_t len;
+} index_key;
+
+struct adopt_index {
+	const adopt_spec *specs;
+	size_t specs_len;
+
+	index_name *names;
+	size_t names_mask;
+
+	/* The first spec for each short alias, indexed by character */
+	const adopt_spec *aliases[256];
+
+	/*
+	 * The spec for each bare argument position; `ADOPT_TYPE_ARGS`
+	 * occupies the position where it begins.
+	 */
+	const adopt_spec **positional;
+	size_t positional_len;
+
+	/* The choice group for each spec, indexed by position */
+	index_choice *choices;
+
+	index_key *keys;
+	size_t keys_mask;
+
+	/* Whether `POSIXLY_CORRECT` was set when compiled */
+	unsigned int posixly_correct : 1;
+};
+
+INLINE(int) index_name_matches(
+	const index_name *entry,
+	const char *arg,
+	size_t len)
+{
+	if (entry->negated)
+		return len == entry->len + 3 &&
+		       memcmp(arg, "no-", 3) == 0 &&
+		       memcmp(arg + 3, entry->spec->name, entry->len) == 0;
+
+	/* A literal is keyed on the empty name, and has no name to compare */
+	return len == entry->len &&
+	       (len == 0 || memcmp(arg, entry->spec->name, len) == 0);
+}
+
+/* The length given for an argument that is NUL-terminated */
+#define ARG_TERMINATED ((size_t)-1)
+
+/*
+ * Whether the argument has a character at the given offset; arguments
+ * are either NUL-terminated or have an explicit length.
+ */
+INLINE(int) arg_has(const char *arg, size_t len, size_t i)
+{
+	return (len == ARG_TERMINATED) ? (arg[i] != '\0') : (i < len);
+}
+
+INLINE(char *) parser_arg(size_t *len, const adopt_parser *parser, size_t idx)
+{
+	if (parser->slices) {
+		*len = parser->slices[idx].len;
+		return parser->slices[idx].ptr;
+	}
+
+	*len = ARG_TERMINATED;
+	return parser->args[idx];
+}
+
+/*
+ * Tags for long options hold the length of the name (following the
+ * "--") in their high bits, and whether it's followed by an '='.  A
+ * name too long to store is found by scanning, as if it were
+ * untagged.  Tags also remember how an option was classified for
+ * GNU-style sorting (see `sort_classify`), and whether its spec was
+ * matched ahead of time (see `adopt_parse_parallel`).
+ */
+#define TAG_EQUALS     (1u << 2)
+#define TAG_SORT_SHIFT 3
+#define TAG_SORT_MASK  0x7u
+#define TAG_MATCHED    (1u << 6)
+#define TAG_NEGATED    (1u << 7)
+#define TAG_NAME_SHIFT 8
+#define TAG_NAME_MAX   (UINT_MAX >> TAG_NAME_SHIFT)
+
+#define tag_has_name(t) \
+	(((t) & ADOPT_TAG_LONG) && ((t) >> TAG_NAME_SHIFT) != TAG_NAME_MAX)
+
+/* Untagged arguments are given a tag with no name, and are scanned */
+INLINE(adopt_tag) parser_tag(const adopt_parser *parser, size_t idx)
+{
+	return parser->tags ? parser->tags[idx] : ADOPT_TAG_BARE;
+}
+
+/*
+ * The spec that was matched to the (first option in the) argument
+ * ahead of time, or NULL if it must be looked up.
+ */
+INLINE(const adopt_spec *const *) parser_matched(
+	const adopt_parser *parser,
+	size_t idx)
+{
+	return (parser->matches && (parser->tags[idx] & TAG_MATCHED)) ?
+		&parser->matches[idx] : NULL;
+}
+
+#if defined(SCAN_AVX2) || defined(SCAN_SSE2)
+
+# ifdef SCAN_AVX2
+#  define SCAN_WIDTH            32
+#  define scan_vec              __m256i
+#  define scan_set(c)           _mm256_set1_epi8(c)
+#  define scan_load(p)          _mm256_load_si256((const __m256i *)(p))
+#  define scan_eq(a, b)         _mm256_cmpeq_epi8(a, b)
+#  define scan_or(a, b)         _mm256_or_si256(a, b)
+#  define scan_movemask(a)      ((unsigned int)_mm256_movemask_epi8(a))
+# else
+#  define SCAN_WIDTH            16
+#  define scan_vec              __m128i
+#  define scan_set(c)           _mm_set1_epi8(c)
+#  define scan_load(p)          _mm_load_si128((const __m128i *)(p))
+#  define scan_eq(a, b)         _mm_cmpeq_epi8(a, b)
+#  define scan_or(a, b)         _mm_or_si128(a, b)
+#  define scan_movemask(a)      ((unsigned int)_mm_movemask_epi8(a))
+# endif
+
+# ifdef _MSC_VER
+INLINE(unsigned int) scan_first(unsigned int mask)
+{
+	unsigned long i;
+	_BitScanForward(&i, mask);
+	return (unsigned int)i;
+}
+# else
+#  define scan_first(mask) ((unsigned int)__builtin_ctz(mask))
+# endif
+
+/*
+ * Find the end of a long option's name: its first '=' or NUL.  A
+ * vector of bytes is compared at a time.  The loads are aligned, so
+ * they never cross into a page beyond the end of the argument, though
+ * they may read (and ignore) the bytes around it.
+ */
+static NO_SANITIZE_ADDRESS size_t name_scan(int *eql, const char *name)
+{
+	const char *p = (const char *)
+		((uintptr_t)name & ~(uintptr_t)(SCAN_WIDTH - 1));
+	scan_vec eqls = scan_set('='), nuls = scan_set('\0'), chunk;
+	unsigned int mask;
+
+	chunk = scan_load(p);
+	mask = scan_movemask(scan_or(scan_eq(chunk, eqls), scan_eq(chunk, nuls)));
+	mask &= ~0u << (name - p);
+
+	while (!mask) {
+		p += SCAN_WIDTH;
+		chunk = scan_load(p);
+		mask = scan_movemask(scan_or(scan_eq(chunk, eqls), scan_eq(chunk, nuls)));
+	}
+
+	p += scan_first(mask);
+
+	*eql = (*p == '=');
+	return (size_t)(p - name);
+}
+
+/*
+ * Find the first delimiter in a list value of the given length, or
+ * the length if there is none.  Like `name_scan`, the loads are
+ * aligned; bytes outside the value are ignored.
+ */
+static NO_SANITIZE_ADDRESS size_t delim_scan(
+	const char *str,
+	size_t len,
+	char delim)
+{
+	const char *p = (const char *)
+		((uintptr_t)str & ~(uintptr_t)(SCAN_WIDTH - 1));
+	scan_vec delims = scan_set(delim);
+	unsigned int mask;
+	size_t offset;
+
+	if (!len)
+		return 0;
+
+	mask = scan_movemask(scan_eq(scan_load(p), delims));
+	mask &= ~0u << (str - p);
+
+	while (!mask) {
+		if ((p += SCAN_WIDTH) >= str + len)
+			return len;
+
+		mask = scan_movemask(scan_eq(scan_load(p), delims));
+	}
+
+	offset = (size_t)(p + scan_first(mask) - str);
+	return (offset < len) ? offset : len;
+}
+
+/* Count the delimiters in a list value of the given length. */
+static NO_SANITIZE_ADDRESS size_t delim_count(
+	const char *str,
+	size_t len,
+	char delim)
+{
+	const char *p = (const char *)
+		((uintptr_t)str & ~(uintptr_t)(SCAN_WIDTH - 1));
+	const char *end = str + len;
+	scan_vec delims = scan_set(delim);
+	unsigned int mask;
+	size_t count = 0;
+
+	if (!len)
+		return 0;
+
+	mask = scan_movemask(scan_eq(scan_load(p), delims));
+	mask &= ~0u << (str - p);
+
+	while (1) {
+		if (end - p < SCAN_WIDTH)
+			mask &= ~(~0u << (end - p));
+
+		for (; mask; mask &= mask - 1)
+			count++;
+
+		if ((p += SCAN_WIDTH) >= end)
+			return count;
+
+		mask = scan_movemask(scan_eq(scan_load(p), delims));
+	}
+}
+
+#else
+
+static size_t name_scan(int *eql, const char *name)
+{
+	size_t len = strcspn(name, "=");
+
+	*eql = (name[len] == '=');
+	return len;
+}
+
+static size_t delim_scan(const char *str, size_t len, char delim)
+{
+	const char *found = len ? memchr(str, delim, len) : NULL;
+	return found ? (size_t)(found - str) : len;
+}
+
+static size_t delim_count(const char *str, size_t len, char delim)
+{
+	const char *end = str + len, *found;
+	size_t count = 0;
+
+	for (; str < end &&
+	       (found = memchr(str, delim, (size_t)(end - str))) != NULL;
+	     str = found + 1)
+		count++;
+
+	return count;
+}
+
+#endif
+
+INLINE(adopt_tag) arg_tag(const char *arg)
+{
+	size_t name_len;
+	int eql;
+
+	if (arg[0] != '-')
+		return ADOPT_TAG_BARE;
+
+	if (arg[1] != '-')
+		return ADOPT_TAG_SHORT;
+
+	if (arg[2] == '\0')
+		return ADOPT_TAG_LITERAL;
+
+	if ((name_len = name_scan(&eql, &arg[2])) > TAG_NAME_MAX)
+		name_len = TAG_NAME_MAX;
+
+	return ADOPT_TAG_LONG | (eql ? TAG_EQUALS : 0) |
+	       (adopt_tag)(name_len << TAG_NAME_SHIFT);
+}
+
+static void classify_args(adopt_tag *tags, char **args, size_t args_len)
+{
+	size_t i;
+
+	for (i = 0; i < args_len; i++)
+		tags[i] = arg_tag(args[i]);
+}
+
+/* The kind of an untagged argument */
+INLINE(adopt_tag_t) arg_kind(const char *arg, size_t len)
+{
+	if (!arg_has(arg, len, 0) || arg[0] != '-')
+		return ADOPT_TAG_BARE;
 
+	if (!arg_has(arg, len, 1) || arg[1] != '-')
+		return ADOPT_TAG_SHORT;
+
+	return arg_has(arg, len, 2) ? ADOPT_TAG_LONG : ADOPT_TAG_LITERAL;
+}
+
+/* Whether the spec name is exactly the given (unterminated) name */
+INLINE(int) spec_name_matches(const char *spec_name, const char *name, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		if (!spec_name[i] || spec_name[i] != name[i])
+			return 0;
+	}
+
+	return (spec_name[len] == '\0');
+}
+
+/*
+ * Probe the table for the name portion of a long argument.  Entries
+ * with the same key are probed in the order of the specs, so the first
+ * matching spec wins, as with a linear scan.
+ */
+INLINE(const adopt_spec *) index_for_long(
+	int *is_negated,
+	const adopt_index *index,
+	const char *name,
+	size_t len,
+	uint32_t hash,
+	int eql)
+{
+	const index_name *entry;
+	size_t i;
+
+	for (i = hash & index->names_mask;
+	     (entry = &index->names[i])->spec;
+	     i = (i + 1) & index->names_mask) {
+		if (entry->hash != hash || !index_name_matches(entry, name, len))
+			continue;
+
+		/* Only "--option=value" may be given with an '=' */
+		if (eql && (entry->negated || !spec_takes_value(entry->spec)))
+			continue;
+
+		if (entry->negated)
+			*is_negated = 1;
+
+		return entry->spec;
+	}
+
+	return NULL;
+}
+
+/*
+ * Find the spec for a long argument (following the "--"), of the given
+ * length.  The name, up to any '=', is scanned once (or its length is
+ * taken from the argument's tag); the value that follows is not
+ * scanned at all.
+ */
 INLINE(const adopt_spec *) spec_for_long(
 	int *is_negated,
 	int *has_value,
 	const char **value,
 	const adopt_parser *parser,
-	const char *arg)
+	const char *arg,
+	size_t len,
+	adopt_tag tag,
+	const adopt_spec *const *matched)
 {
 	const adopt_spec *spec;
-	char *eql;
-	size_t eql_pos;
+	uint32_t hash = INDEX_HASH_INIT;
+	size_t name_len, i;
+	int eql;
+
+	if (tag_has_name(tag)) {
+		name_len = tag >> TAG_NAME_SHIFT;
+		eql = !!(tag & TAG_EQUALS);
+
+		if (matched) {
+			spec = *matched;
+
+			if ((tag & TAG_NEGATED))
+				*is_negated = 1;
+
+			goto done;
+		}
+
+		if (parser->index) {
+			for (i = 0; i < name_len; i++)
+				hash = INDEX_HASH(hash, arg[i]);
+		}
+	} else {
+		for (name_len = 0; arg_has(arg, len, name_len) && arg[name_len] != '='; name_len++)
+			hash = INDEX_HASH(hash, arg[name_len]);
+
+		eql = arg_has(arg, len, name_len);
+	}
 
-	eql = strchr(arg, '=');
-	eql_pos = (eql = strchr(arg, '=')) ? (size_t)(eql - arg) : strlen(arg);
+	if (parser->index) {
+		spec = index_for_long(is_negated, parser->index, arg, name_len, hash, eql);
+		goto done;
+	}
 
 	for (spec = parser->specs; spec->type; ++spec) {
 		/* Handle -- (everything after this is literal) */
-		if (spec->type == ADOPT_TYPE_LITERAL && arg[0] == '\0')
-			return spec;
+		if (spec->type == ADOPT_TYPE_LITERAL && name_len == 0 && !eql)
+			goto done;
 
 		/* Handle --no-option arguments for bool types */
-		if (spec->type == ADOPT_TYPE_BOOL &&
-		    strncmp(arg, "no-", 3) == 0 &&
-		    strcmp(arg + 3, spec->name) == 0) {
+		if (spec->type == ADOPT_TYPE_BOOL && !eql &&
+		    name_len > 3 && memcmp(arg, "no-", 3) == 0 &&
+		    spec_name_matches(spec->name, arg + 3, name_len - 3)) {
 			*is_negated = 1;
-			return spec;
+			goto done;
 		}
 
 		/* Handle the typical --option arguments */
-		if (spec_is_option_type(spec) &&
-		    spec->name &&
-		    strcmp(arg, spec->name) == 0)
-			return spec;
+		if (spec_is_option_type(spec) && spec->name && !eql &&
+		    spec_name_matches(spec->name, arg, name_len))
+			goto done;
 
 		/* Handle --option=value arguments */
-		if (spec->type == ADOPT_TYPE_VALUE &&
-		    spec->name && eql &&
-		    strncmp(arg, spec->name, eql_pos) == 0 &&
-		    spec->name[eql_pos] == '\0') {
-			*has_value = 1;
-			*value = arg[eql_pos + 1] ? &arg[eql_pos + 1] : NULL;
-			return spec;
-		}
+		if (spec_takes_value(spec) && spec->name && eql &&
+		    spec_name_matches(spec->name, arg, name_len))
+			goto done;
 	}
 
-	return NULL;
+	spec = NULL;
+
+done:
+	if (spec && eql) {
+		*has_value = 1;
+		*value = arg_has(arg, len, name_len + 1) ? &arg[name_len + 1] : NULL;
+	}
+
+	return spec;
 }
 
+/*
+ * Find the spec for the short option at the start of the argument; `len`
+ * is the length of the remainder of the argument, including the option.
+ */
 INLINE(const adopt_spec *) spec_for_short(
 	const char **value,
 	const adopt_parser *parser,
-	const char *arg)
+	const char *arg,
+	size_t len,
+	const adopt_spec *const *matched)
 {
 	const adopt_spec *spec;
 
+	/*
+	 * A lone "-" names no option, nor does a NUL in a slice; don't
+	 * match a spec without an alias.
+	 */
+	if (!arg_has(arg, len, 0) || !arg[0]) {
+		*value = NULL;
+		return NULL;
+	}
+
+	if (matched) {
+		spec = *matched;
+		*value = (spec && spec_takes_value(spec) &&
+		          arg_has(arg, len, 1)) ? &arg[1] : NULL;
+		return spec;
+	}
+
+	if (parser->index) {
+		spec = parser->index->aliases[(unsigned char)arg[0]];
+
+		if (spec && spec_takes_value(spec) && arg_has(arg, len, 1))
+			*value = &arg[1];
+		else
+			*value = NULL;
+
+		return spec;
+	}
+
 	for (spec = parser->specs; spec->type; ++spec) {
 		/* Handle -svalue short options with a value */
-		if (spec->type == ADOPT_TYPE_VALUE &&
+		if (spec_takes_value(spec) &&
 		    arg[0] == spec->alias &&
-		    arg[1] != '\0') {
+		    arg_has(arg, len, 1)) {
 			*value = &arg[1];
 			return spec;
 		}
@@ -118,6 +638,18 @@ INLINE(const adopt_spec *) spec_for_arg(adopt_parser *parser)
 	const adopt_spec *spec;
 	size_t args = 0;
 
+	if (parser->index) {
+		if (parser->arg_idx >= parser->index->positional_len)
+			return NULL;
+
+		spec = parser->index->positional[parser->arg_idx];
+
+		if (spec && spec->type == ADOPT_TYPE_ARG)
+			parser->arg_idx++;
+
+		return spec;
+	}
+
 	for (spec = parser->specs; spec->type; ++spec) {
 		if (spec->type == ADOPT_TYPE_ARG) {
 			if (args == parser->arg_idx) {
@@ -135,6 +667,32 @@ INLINE(const adopt_spec *) spec_for_arg(adopt_parser *parser)
 	return NULL;
 }
 
+/*
+ * Resolve a spec's `value`: when parsing into a configuration
+ * structure, it's the (biased) offset of the member.
+ */
+INLINE(void *) spec_bound(const adopt_parser *parser, void *value)
+{
+	if (parser->config && value)
+		return (char *)parser->config + ((uintptr_t)value - 1);
+
+	return value;
+}
+
+/*
+ * Where the value for a spec is written: its slot in the parser's
+ * result block, when one was given, or the spec's own `value`.
+ */
+INLINE(void *) spec_target(
+	const adopt_parser *parser,
+	const adopt_spec *spec)
+{
+	if (parser->results)
+		return &parser->results[spec - parser->specs];
+
+	return spec_bound(parser, spec->value);
+}
+
 INLINE(int) spec_is_choice(const adopt_spec *spec)
 {
 	return ((spec + 1)->type &&
@@ -147,6 +705,11 @@ INLINE(int) spec_is_choice(const adopt_spec *spec)
  */
 INLINE(void) consume_choices(const adopt_spec *spec, adopt_parser *parser)
 {
+	if (parser->index) {
+		parser->arg_idx += parser->index->choices[spec - parser->specs].args;
+		return;
+	}
+
 	/* back up to the beginning of the choices */
 	while (spec->type && (spec->usage & ADOPT_USAGE_CHOICE))
 		--spec;
@@ -161,420 +724,3544 @@ INLINE(void) consume_choices(const adopt_spec *spec, adopt_parser *parser)
 	} while(spec->type && (spec->usage & ADOPT_USAGE_CHOICE));
 }
 
-static adopt_status_t parse_long(adopt_opt *opt, adopt_parser *parser)
+INLINE(const adopt_spec *) spec_for_sort(
+	int *needs_value,
+	const adopt_parser *parser,
+	const char *arg,
+	adopt_tag tag,
+	const adopt_spec *const *matched)
 {
-	const adopt_spec *spec;
-	char *arg = parser->args[parser->idx++];
-	const char *value = NULL;
-	int is_negated = 0, has_value = 0;
+	int is_negated, has_value = 0;
+	const char *value;
+	const adopt_spec *spec = NULL;
+	size_t idx = 0;
 
-	opt->arg = arg;
+	*needs_value = 0;
 
-	if ((spec = spec_for_long(&is_negated, &has_value, &value, parser, &arg[2])) == NULL) {
-		opt->spec = NULL;
-		opt->status = ADOPT_STATUS_UNKNOWN_OPTION;
-		goto done;
+	if (strncmp(arg, "--", 2) == 0) {
+		spec = spec_for_long(&is_negated, &has_value, &value, parser, &arg[2], ARG_TERMINATED, tag, matched);
+		*needs_value = !has_value;
 	}
 
-	opt->spec = spec;
+	else if (strncmp(arg, "-", 1) == 0) {
+		spec = spec_for_short(&value, parser, &arg[1], ARG_TERMINATED, matched);
 
-	/* Future options parsed as literal */
-	if (spec->type == ADOPT_TYPE_LITERAL)
-		parser->in_literal = 1;
+		/*
+		 * Advance through compressed short arguments to see if
+		 * the last one has a value, eg "-xvffilename".
+		 */
+		while (spec && !value && arg[1 + ++idx] != '\0')
+			spec = spec_for_short(&value, parser, &arg[1 + idx], ARG_TERMINATED, NULL);
 
-	/* --bool or --no-bool */
-	else if (spec->type == ADOPT_TYPE_BOOL && spec->value)
-		*((int *)spec->value) = !is_negated;
+		*needs_value = (value == NULL);
+	}
 
-	/* --accumulate */
-	else if (spec->type == ADOPT_TYPE_ACCUMULATOR && spec->value)
-		*((int *)spec->value) += spec->switch_value ? spec->switch_value : 1;
+	return spec;
+}
 
-	/* --switch */
-	else if (spec->type == ADOPT_TYPE_SWITCH && spec->value)
-		*((int *)spec->value) = spec->switch_value;
+#define words_terminator(x) \
+	((x)->data ? (const char *)(x)->data : ";")
 
-	/* Parse values as "--foo=bar" or "--foo bar" */
-	else if (spec->type == ADOPT_TYPE_VALUE) {
-		if (has_value)
-			opt->value = (char *)value;
+/*
+ * Count the words that an `ADOPT_TYPE_WORDS` or `ADOPT_TYPE_WORDS_UNTIL`
+ * takes, beginning at the given position (not including the
+ * terminator); returns -1 if there are too few, or no terminator.
+ */
+static int words_count(
+	size_t *count,
+	const adopt_parser *parser,
+	const adopt_spec *spec,
+	size_t start)
+{
+	const char *terminator, *word;
+	size_t idx, len, terminator_len;
+
+	if (spec->type == ADOPT_TYPE_WORDS) {
+		*count = (spec->switch_value > 0) ? (size_t)spec->switch_value : 0;
+		return (*count <= parser->args_len - start) ? 0 : -1;
+	}
+
+	terminator = words_terminator(spec);
+	terminator_len = strlen(terminator);
+
+	for (idx = start; idx < parser->args_len; idx++) {
+		word = parser_arg(&len, parser, idx);
+
+		if ((len == ARG_TERMINATED) ? strcmp(word, terminator) == 0 :
+		    (len == terminator_len && memcmp(word, terminator, len) == 0)) {
+			*count = idx - start;
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+typedef enum {
+	SORT_BARE = 0,
+	SORT_OPTION,
+	SORT_LITERAL,
+	SORT_DANGLING
+} sort_kind_t;
+
+/*
+ * Classify the argument at the given position for sorting; options
+ * that take their value from the next argument span two positions,
+ * and options that take words span them all.
+ */
+INLINE(sort_kind_t) sort_classify_arg(
+	size_t *len,
+	const adopt_parser *parser,
+	size_t idx,
+	adopt_tag tag)
+{
+	const adopt_spec *spec;
+	size_t count;
+	int needs_value;
+
+	*len = 1;
+
+	/* Not a "-" or "--" prefixed option. */
+	if ((spec = spec_for_sort(&needs_value, parser, parser->args[idx],
+			tag, parser_matched(parser, idx))) == NULL)
+		return SORT_BARE;
+
+	/* A "--" alone means remaining args are literal. */
+	if (spec->type == ADOPT_TYPE_LITERAL)
+		return SORT_LITERAL;
+
+	/*
+	 * If the argument is a value type and doesn't already have a
+	 * value (eg "--foo=bar" or "-fbar") then the next argument is
+	 * its value, and moves with it.
+	 */
+	if (spec_takes_value(spec) && needs_value) {
+		if (idx + 1 >= parser->args_len)
+			return SORT_DANGLING;
+
+		*len = 2;
+	}
+
+	if (spec_takes_words(spec) && needs_value) {
+		if (words_count(&count, parser, spec, idx + 1) < 0)
+			return SORT_DANGLING;
+
+		*len = 1 + count + (spec->type == ADOPT_TYPE_WORDS_UNTIL);
+	}
+
+	return SORT_OPTION;
+}
+
+/*
+ * GNU-style parsing classifies the options following the first bare
+ * argument several times (to find them, to parse them and to sort
+ * them); when the arguments are tagged, the classification is kept
+ * in the tag, so each option's spec is only looked up once.
+ */
+INLINE(sort_kind_t) sort_classify(
+	size_t *len,
+	const adopt_parser *parser,
+	size_t idx)
+{
+	adopt_tag tag, sort;
+	sort_kind_t kind;
+
+	if (!parser->tags)
+		return sort_classify_arg(len, parser, idx, ADOPT_TAG_BARE);
+
+	tag = parser->tags[idx];
+
+	if (ADOPT_TAG_KIND(tag) == ADOPT_TAG_BARE) {
+		*len = 1;
+		return SORT_BARE;
+	}
+
+	if ((sort = (tag >> TAG_SORT_SHIFT) & TAG_SORT_MASK) != 0) {
+		*len = ((sort - 1) & 1) + 1;
+		return (sort_kind_t)((sort - 1) >> 1);
+	}
+
+	kind = sort_classify_arg(len, parser, idx, tag);
+
+	/*
+	 * A dangling option depends on its position, not just the
+	 * argument; only the lengths of options with (at most) one value
+	 * fit in the tag.
+	 */
+	if (kind != SORT_DANGLING && *len <= 2) {
+		sort = (((adopt_tag)kind << 1) | (adopt_tag)(*len - 1)) + 1;
+		parser->tags[idx] = tag | (sort << TAG_SORT_SHIFT);
+	}
+
+	return kind;
+}
+
+/*
+ * Store a value in the spec's target; when parsing slices, the value
+ * is not NUL-terminated, so it is stored as an `adopt_slice`.
+ */
+INLINE(void) target_set_value(
+	void *target,
+	const adopt_parser *parser,
+	char *value,
+	size_t len)
+{
+	if (target && parser->slices) {
+		((adopt_slice *)target)->ptr = value;
+		((adopt_slice *)target)->len = value ? len : 0;
+	} else if (target) {
+		*((char **)target) = value;
+	}
+}
+
+/*
+ * Allocate from the arena by advancing through it, aligning the
+ * allocation to `align` (a power of two).
+ */
+static void *arena_alloc(adopt_arena *arena, size_t len, size_t align)
+{
+	size_t pad = (align - ((uintptr_t)(arena->buf + arena->len) & (align - 1))) & (align - 1);
+
+	if (pad > arena->size - arena->len ||
+	    len > arena->size - arena->len - pad)
+		return NULL;
+
+	arena->len += pad + len;
+	return arena->buf + arena->len - len;
+}
+
+/*
+ * Copy a value into the parser's arena when parsing with
+ * `ADOPT_PARSE_COPY_VALUES`; the copy is NUL-terminated, even when
+ * parsing slices.
+ */
+static int value_copy(
+	char **out,
+	const adopt_parser *parser,
+	const char *value,
+	size_t len)
+{
+	char *copy;
+
+	if (!value || !(parser->flags & ADOPT_PARSE_COPY_VALUES)) {
+		*out = (char *)value;
+		return 0;
+	}
+
+	if (!parser->slices)
+		len = strlen(value);
+
+	if (!parser->arena || len == SIZE_MAX ||
+	    (copy = arena_alloc(parser->arena, len + 1, 1)) == NULL)
+		return -1;
+
+	memcpy(copy, value, len);
+	copy[len] = '\0';
+
+	*out = copy;
+	return 0;
+}
+
+/*
+ * Copy a range of the arguments (of an `ADOPT_TYPE_ARGS`, or the
+ * words of an option) into the parser's arena, storing the copied
+ * array in the target.
+ */
+static int args_copy(
+	void *target,
+	const adopt_parser *parser,
+	size_t idx,
+	size_t len)
+{
+	adopt_slice *slices;
+	char **args;
+	size_t i;
+
+	if (!parser->arena)
+		return -1;
+
+	if (parser->slices) {
+		if ((slices = arena_alloc(parser->arena, sizeof(adopt_slice) * len,
+				sizeof(void *))) == NULL)
+			return -1;
+
+		for (i = 0; i < len; i++) {
+			slices[i].len = parser->slices[idx + i].len;
+
+			if (value_copy(&slices[i].ptr, parser,
+					parser->slices[idx + i].ptr, slices[i].len) < 0)
+				return -1;
+		}
+
+		*((const adopt_slice **)target) = slices;
+	} else {
+		if ((args = arena_alloc(parser->arena, sizeof(char *) * (len + 1),
+				sizeof(char *))) == NULL)
+			return -1;
+
+		for (i = 0; i < len; i++) {
+			if (value_copy(&args[i], parser, parser->args[idx + i], 0) < 0)
+				return -1;
+		}
+
+		args[len] = NULL;
+		*((char ***)target) = args;
+	}
+
+	return 0;
+}
+
+/*
+ * Count the remaining occurrences of a spec, so that its values can be
+ * allocated at once.  An argument that is given as another option's
+ * value may be counted, so this may overcount, but never undercounts.
+ * Arguments from a source can't be counted ahead of time.
+ */
+static size_t count_values(const adopt_parser *parser, const adopt_spec *spec)
+{
+	const adopt_spec *found;
+	size_t idx, count = 0;
+	int needs_value;
+
+	if (!parser->args || parser->in_literal)
+		return 0;
+
+	for (idx = parser->idx; idx < parser->args_len; idx++) {
+		found = spec_for_sort(&needs_value, parser, parser->args[idx],
+			parser_tag(parser, idx), parser_matched(parser, idx));
+
+		if (found == spec)
+			count++;
+		else if (found && found->type == ADOPT_TYPE_LITERAL)
+			break;
+	}
+
+	return count;
+}
+
+/* The initial size of values from a source or slices, which are not counted */
+#define VALUES_MIN_ALLOC 8
+
+/*
+ * Grow the array of a spec's collected values, which is full, sized
+ * for the remaining occurrences of the spec (plus `reserve` more
+ * items), from the arena or with `realloc`.  Sources and slices can't
+ * be counted, so their arrays are doubled instead.
+ */
+static void *collect_grow(
+	const adopt_parser *parser,
+	const adopt_spec *spec,
+	void *items,
+	size_t len,
+	size_t *alloc,
+	size_t item_size,
+	size_t reserve)
+{
+	void *grown;
+	size_t new_alloc;
+
+	if (parser->source || parser->slices)
+		new_alloc = *alloc ? *alloc * 2 : VALUES_MIN_ALLOC;
+	else
+		new_alloc = len + 1 + count_values(parser, spec);
+
+	if (new_alloc > (SIZE_MAX / item_size) - reserve)
+		return NULL;
+
+	if (parser->arena) {
+		if ((grown = arena_alloc(parser->arena, item_size * (new_alloc + reserve),
+				sizeof(uint64_t))) == NULL)
+			return NULL;
+
+		if (len)
+			memcpy(grown, items, item_size * len);
+	} else if ((grown = realloc(items, item_size * (new_alloc + reserve))) == NULL) {
+		return NULL;
+	}
+
+	*alloc = new_alloc;
+	return grown;
+}
+
+static int values_append(
+	const adopt_parser *parser,
+	const adopt_spec *spec,
+	adopt_values *values,
+	char *value,
+	size_t len)
+{
+	char **grown;
+	adopt_slice *grown_slices;
+
+	if (parser->slices) {
+		if (values->len == values->alloc) {
+			if ((grown_slices = collect_grow(parser, spec, values->slices,
+					values->len, &values->alloc,
+					sizeof(adopt_slice), 0)) == NULL)
+				return -1;
+
+			values->slices = grown_slices;
+		}
+
+		values->slices[values->len].ptr = value;
+		values->slices[values->len++].len = len;
+		return 0;
+	}
+
+	if (values->len == values->alloc) {
+		if ((grown = collect_grow(parser, spec, values->values, values->len,
+				&values->alloc, sizeof(char *), 1)) == NULL)
+			return -1;
+
+		values->values = grown;
+	}
+
+	values->values[values->len++] = value;
+	values->values[values->len] = NULL;
+
+	return 0;
+}
+
+static int key_values_append(
+	const adopt_parser *parser,
+	const adopt_spec *spec,
+	adopt_key_values *key_values,
+	char *value,
+	size_t len)
+{
+	adopt_key_value *grown, *item;
+	size_t key_len;
+
+	if (key_values->len == key_values->alloc) {
+		if ((grown = collect_grow(parser, spec, key_values->items,
+				key_values->len, &key_values->alloc,
+				sizeof(adopt_key_value), 0)) == NULL)
+			return -1;
+
+		key_values->items = grown;
+	}
+
+	key_len = delim_scan(value, len, '=');
+
+	item = &key_values->items[key_values->len++];
+	item->key.ptr = value;
+	item->key.len = key_len;
+	item->value.ptr = (key_len < len) ? &value[key_len + 1] : NULL;
+	item->value.len = (key_len < len) ? len - key_len - 1 : 0;
+
+	return 0;
+}
+
+/*
+ * Parse the digits of an unsigned decimal integer, without regard to
+ * the locale.  An integer too large to represent is reported once all
+ * the digits have been validated.
+ */
+static adopt_status_t parse_digits(uint64_t *out, const char *str, size_t len)
+{
+	uint64_t n = 0;
+	unsigned int digit;
+	size_t i;
+	int overflow = 0;
+
+	if (!len)
+		return ADOPT_STATUS_INVALID_VALUE;
+
+	for (i = 0; i < len; i++) {
+		if ((digit = (unsigned char)str[i] - '0') > 9)
+			return ADOPT_STATUS_INVALID_VALUE;
+
+		if (n > (UINT64_MAX - digit) / 10)
+			overflow = 1;
+		else
+			n = (n * 10) + digit;
+	}
+
+	*out = n;
+	return overflow ? ADOPT_STATUS_VALUE_OUT_OF_RANGE : ADOPT_STATUS_OK;
+}
+
+static adopt_status_t parse_integer(
+	void *target,
+	adopt_type_t type,
+	const char *str,
+	size_t len)
+{
+	uint64_t n, max;
+	adopt_status_t status;
+	int negative = 0;
+
+	if (len && (str[0] == '-' || str[0] == '+')) {
+		negative = (str[0] == '-');
+		str++;
+		len--;
+	}
+
+	if ((status = parse_digits(&n, str, len)) != ADOPT_STATUS_OK)
+		return status;
+
+	if (type == ADOPT_TYPE_INT32)
+		max = (uint64_t)INT32_MAX + negative;
+	else if (type == ADOPT_TYPE_INT64)
+		max = (uint64_t)INT64_MAX + negative;
+	else if (type == ADOPT_TYPE_UINT32)
+		max = negative ? 0 : UINT32_MAX;
+	else
+		max = negative ? 0 : UINT64_MAX;
+
+	if (n > max)
+		return ADOPT_STATUS_VALUE_OUT_OF_RANGE;
+
+	if (!target)
+		return ADOPT_STATUS_OK;
+
+	/* Negate in the unsigned domain, so that the minimum fits */
+	if (type == ADOPT_TYPE_INT32)
+		*((int32_t *)target) = negative ? (int32_t)(-(int64_t)n) : (int32_t)n;
+	else if (type == ADOPT_TYPE_INT64)
+		*((int64_t *)target) = negative ? -(int64_t)(n - 1) - 1 : (int64_t)n;
+	else if (type == ADOPT_TYPE_UINT32)
+		*((uint32_t *)target) = (uint32_t)n;
+	else
+		*((uint64_t *)target) = n;
+
+	return ADOPT_STATUS_OK;
+}
+
+/* Powers of ten that are exactly representable as a double */
+static const double exact_pow10[] = {
+	1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,
+	1e8,  1e9,  1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+	1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+#define EXACT_POW10_MAX 22
+#define EXACT_MANTISSA_MAX ((uint64_t)1 << 53)
+#define DOUBLE_BUF_LEN 64
+
+/*
+ * Convert a validated floating-point number that can't be computed
+ * exactly with `strtod`, substituting the locale's decimal point.
+ */
+static adopt_status_t parse_double_slow(double *out, const char *str, size_t len)
+{
+	char buf[DOUBLE_BUF_LEN], *copy = buf;
+	const char *point = localeconv()->decimal_point;
+	size_t point_len = strlen(point), i, j;
+	adopt_status_t status = ADOPT_STATUS_OK;
+
+	if (len + point_len + 1 > DOUBLE_BUF_LEN &&
+	    (copy = malloc(len + point_len + 1)) == NULL)
+		return ADOPT_STATUS_OUT_OF_MEMORY;
+
+	for (i = 0, j = 0; i < len; i++) {
+		if (str[i] == '.') {
+			memcpy(&copy[j], point, point_len);
+			j += point_len;
+		} else {
+			copy[j++] = str[i];
+		}
+	}
+
+	copy[j] = '\0';
+
+	errno = 0;
+	*out = strtod(copy, NULL);
+
+	if (errno == ERANGE && (*out == HUGE_VAL || *out == -HUGE_VAL))
+		status = ADOPT_STATUS_VALUE_OUT_OF_RANGE;
+
+	if (copy != buf)
+		free(copy);
+
+	return status;
+}
+
+/*
+ * Parse a floating-point number, without regard to the locale.  When
+ * the significant digits and the power of ten are both exactly
+ * representable, the result is computed directly (and is correctly
+ * rounded); otherwise, it falls back to `strtod`.
+ */
+static adopt_status_t parse_double(double *target, const char *str, size_t len)
+{
+	uint64_t mantissa = 0;
+	unsigned int digit;
+	size_t i = 0, digits = 0;
+	long exponent = 0, given_exponent = 0;
+	int negative = 0, negative_exponent = 0, exact = 1;
+	double d;
+	adopt_status_t status;
+
+	if (i < len && (str[i] == '-' || str[i] == '+'))
+		negative = (str[i++] == '-');
+
+	/* Digits that don't fit in the mantissa are dropped */
+	for (; i < len && (digit = (unsigned char)str[i] - '0') <= 9; i++, digits++) {
+		if (mantissa > (EXACT_MANTISSA_MAX - digit) / 10) {
+			exact = 0;
+			exponent++;
+		} else {
+			mantissa = (mantissa * 10) + digit;
+		}
+	}
+
+	if (i < len && str[i] == '.') {
+		for (i++; i < len && (digit = (unsigned char)str[i] - '0') <= 9; i++, digits++) {
+			if (mantissa > (EXACT_MANTISSA_MAX - digit) / 10) {
+				exact = 0;
+			} else {
+				mantissa = (mantissa * 10) + digit;
+				exponent--;
+			}
+		}
+	}
+
+	if (!digits)
+		return ADOPT_STATUS_INVALID_VALUE;
+
+	if (i < len && (str[i] == 'e' || str[i] == 'E')) {
+		if (++i < len && (str[i] == '-' || str[i] == '+'))
+			negative_exponent = (str[i++] == '-');
+
+		if (i == len)
+			return ADOPT_STATUS_INVALID_VALUE;
+
+		for (; i < len && (digit = (unsigned char)str[i] - '0') <= 9; i++) {
+			if (given_exponent < 100000)
+				given_exponent = (given_exponent * 10) + digit;
+		}
+
+		exponent += negative_exponent ? -given_exponent : given_exponent;
+	}
+
+	if (i != len)
+		return ADOPT_STATUS_INVALID_VALUE;
+
+	if (mantissa == 0 && exact) {
+		d = 0.0;
+	} else if (exact && exponent >= -EXACT_POW10_MAX && exponent <= EXACT_POW10_MAX) {
+		d = (double)mantissa;
+		d = (exponent < 0) ? d / exact_pow10[-exponent] : d * exact_pow10[exponent];
+	} else {
+		if ((status = parse_double_slow(&d, str, len)) != ADOPT_STATUS_OK)
+			return status;
+
+		negative = 0;
+	}
+
+	if (target)
+		*target = negative ? -d : d;
+
+	return ADOPT_STATUS_OK;
+}
+
+typedef struct {
+	const char *name;
+	uint64_t scale;
+} unit_entry;
+
+#define KIB ((uint64_t)1 << 10)
+#define MIB ((uint64_t)1 << 20)
+#define GIB ((uint64_t)1 << 30)
+#define TIB ((uint64_t)1 << 40)
+#define PIB ((uint64_t)1 << 50)
+#define EIB ((uint64_t)1 << 60)
+
+/* Size units, in bytes; these are matched case insensitively */
+static const unit_entry size_units[] = {
+	{ "",    1   }, { "B",   1   },
+	{ "K",   KIB }, { "KB",  KIB }, { "KiB", KIB },
+	{ "M",   MIB }, { "MB",  MIB }, { "MiB", MIB },
+	{ "G",   GIB }, { "GB",  GIB }, { "GiB", GIB },
+	{ "T",   TIB }, { "TB",  TIB }, { "TiB", TIB },
+	{ "P",   PIB }, { "PB",  PIB }, { "PiB", PIB },
+	{ "E",   EIB }, { "EB",  EIB }, { "EiB", EIB },
+	{ NULL }
+};
+
+#define NSEC_PER_SEC ((uint64_t)1000000000)
+
+/* Duration units, in nanoseconds */
+static const unit_entry duration_units[] = {
+	{ "",   NSEC_PER_SEC },
+	{ "ns", 1 },
+	{ "us", 1000 },
+	{ "ms", 1000000 },
+	{ "s",  NSEC_PER_SEC },
+	{ "m",  NSEC_PER_SEC * 60 },
+	{ "h",  NSEC_PER_SEC * 60 * 60 },
+	{ "d",  NSEC_PER_SEC * 60 * 60 * 24 },
+	{ NULL }
+};
+
+/* Ratio units, in parts per million */
+static const unit_entry ratio_units[] = {
+	{ "",    1000000 },
+	{ "%",   10000 },
+	{ "ppm", 1 },
+	{ NULL }
+};
+
+#define ascii_tolower(c) (((c) >= 'A' && (c) <= 'Z') ? (c) + ('a' - 'A') : (c))
+
+static const unit_entry *unit_lookup(
+	adopt_type_t type,
+	const char *str,
+	size_t len)
+{
+	const unit_entry *unit;
+	int icase = (type == ADOPT_TYPE_SIZE);
+	size_t i;
+
+	if (type == ADOPT_TYPE_SIZE)
+		unit = size_units;
+	else if (type == ADOPT_TYPE_DURATION)
+		unit = duration_units;
+	else
+		unit = ratio_units;
+
+	for (; unit->name; unit++) {
+		for (i = 0; i < len && unit->name[i]; i++) {
+			if (unit->name[i] != str[i] &&
+			    (!icase || ascii_tolower(unit->name[i]) != ascii_tolower(str[i])))
+				break;
+		}
+
+		if (i == len && !unit->name[i])
+			return unit;
+	}
+
+	return NULL;
+}
+
+/*
+ * The number of fractional digits that are significant in a scaled
+ * value; this is the precision of the smallest units (for example,
+ * nanoseconds in a number of seconds), and keeps the intermediate
+ * products within 64 bits.
+ */
+#define SCALED_FRACTION_MAX 1000000000
+
+/*
+ * Parse a number followed by a unit, in one scan, and scale it by the
+ * unit.  The whole and fractional parts are scaled separately, so the
+ * result is exact (but truncated) without floating point.
+ */
+static adopt_status_t parse_scaled(
+	uint64_t *target,
+	adopt_type_t type,
+	const char *str,
+	size_t len)
+{
+	const unit_entry *unit;
+	uint64_t whole = 0, frac = 0, frac_scale = 1, frac_value;
+	unsigned int digit;
+	size_t i = 0, digits = 0;
+	int overflow = 0;
+
+	for (; i < len && (digit = (unsigned char)str[i] - '0') <= 9; i++, digits++) {
+		if (whole > (UINT64_MAX - digit) / 10)
+			overflow = 1;
+		else
+			whole = (whole * 10) + digit;
+	}
+
+	if (i < len && str[i] == '.') {
+		for (i++; i < len && (digit = (unsigned char)str[i] - '0') <= 9; i++, digits++) {
+			if (frac_scale < SCALED_FRACTION_MAX) {
+				frac = (frac * 10) + digit;
+				frac_scale *= 10;
+			}
+		}
+	}
+
+	if (!digits)
+		return ADOPT_STATUS_INVALID_VALUE;
+
+	if ((unit = unit_lookup(type, &str[i], len - i)) == NULL)
+		return ADOPT_STATUS_UNKNOWN_UNIT;
+
+	/* frac * scale / frac_scale, without overflowing */
+	frac_value = (frac * (unit->scale / frac_scale)) +
+		((frac * (unit->scale % frac_scale)) / frac_scale);
+
+	if (overflow ||
+	    whole > UINT64_MAX / unit->scale ||
+	    whole * unit->scale > UINT64_MAX - frac_value)
+		return ADOPT_STATUS_VALUE_OUT_OF_RANGE;
+
+	if (target)
+		*target = (whole * unit->scale) + frac_value;
+
+	return ADOPT_STATUS_OK;
+}
+
+/*
+ * Convert the value of a numeric option into the spec's target; the
+ * target may be NULL, in which case the value is only validated.
+ */
+static adopt_status_t numeric_set(
+	void *target,
+	adopt_type_t type,
+	const char *value,
+	size_t len)
+{
+	if (type == ADOPT_TYPE_DOUBLE)
+		return parse_double(target, value, len);
+
+	if (type == ADOPT_TYPE_SIZE ||
+	    type == ADOPT_TYPE_DURATION ||
+	    type == ADOPT_TYPE_RATIO)
+		return parse_scaled(target, type, value, len);
+
+	return parse_integer(target, type, value, len);
+}
+
+static const void *index_key_lookup(
+	const adopt_index *index,
+	const adopt_spec *spec,
+	const char *str,
+	size_t len)
+{
+	const index_key *entry;
+	uint32_t hash = INDEX_HASH_INIT;
+	size_t i;
+
+	if (!index->keys)
+		return NULL;
+
+	for (i = 0; i < len; i++)
+		hash = INDEX_HASH(hash, str[i]);
+
+	for (i = hash & index->keys_mask;
+	     (entry = &index->keys[i])->spec;
+	     i = (i + 1) & index->keys_mask) {
+		if (entry->spec == spec && entry->hash == hash &&
+		    entry->len == len && memcmp(entry->name, str, len) == 0)
+			return entry->item;
+	}
+
+	return NULL;
+}
+
+INLINE(int) key_matches(const char *name, const char *str, size_t len)
+{
+	return name && strncmp(name, str, len) == 0 && !name[len];
+}
+
+/*
+ * Find the given value among an `ADOPT_TYPE_ENUM`'s allowed values,
+ * in the index's hash table; without an index, they're compared in
+ * order.
+ */
+static const adopt_enum_value *enum_lookup(
+	const adopt_parser *parser,
+	const adopt_spec *spec,
+	const char *str,
+	size_t len)
+{
+	const adopt_enum_value *value;
+
+	if (parser->index)
+		return index_key_lookup(parser->index, spec, str, len);
+
+	for (value = spec_enum_values(spec); value && value->name; value++) {
+		if (key_matches(value->name, str, len))
+			return value;
+	}
+
+	return NULL;
+}
+
+/* Find a sub-option of an `ADOPT_TYPE_SUBOPTS`, like `enum_lookup`. */
+static const adopt_spec *subopt_lookup(
+	const adopt_parser *parser,
+	const adopt_spec *spec,
+	const char *str,
+	size_t len)
+{
+	const adopt_spec *sub;
+
+	if (parser->index)
+		return index_key_lookup(parser->index, spec, str, len);
+
+	for (sub = spec_subopts(spec); sub && sub->type; sub++) {
+		if (key_matches(sub->name, str, len))
+			return sub;
+	}
+
+	return NULL;
+}
+
+/*
+ * Grow a list's array to hold `add` more items, from the arena or with
+ * `realloc`.
+ */
+static void *list_grow(
+	const adopt_parser *parser,
+	void *items,
+	size_t len,
+	size_t add,
+	size_t item_size)
+{
+	void *grown;
+
+	if (add > (SIZE_MAX / item_size) - len)
+		return NULL;
+
+	if (!parser->arena)
+		return realloc(items, (len + add) * item_size);
+
+	if ((grown = arena_alloc(parser->arena, (len + add) * item_size,
+			sizeof(uint64_t))) != NULL && len)
+		memcpy(grown, items, len * item_size);
+
+	return grown;
+}
+
+/*
+ * Split a list value on its delimiter, and add its items to the
+ * spec's target.  The delimiters are counted first, so that a list's
+ * array grows once per value; a bitmask needs no array.
+ */
+static adopt_status_t list_set(
+	const adopt_parser *parser,
+	const adopt_spec *spec,
+	void *target,
+	char *value,
+	size_t len)
+{
+	adopt_list *list = target;
+	adopt_int_list *ints = target;
+	const adopt_enum_value *flag;
+	char delim = spec->switch_value ? (char)spec->switch_value : ',';
+	size_t count, item_len, given = 0;
+	adopt_status_t status;
+	int64_t n;
+	int mask = 0;
+	void *items;
+
+	if (target && spec->type != ADOPT_TYPE_BITMASK) {
+		count = delim_count(value, len, delim) + 1;
+
+		if (spec->type == ADOPT_TYPE_LIST)
+			items = list_grow(parser, list->items, list->len, count, sizeof(adopt_slice));
+		else
+			items = list_grow(parser, ints->items, ints->len, count, sizeof(int64_t));
+
+		if (!items)
+			return ADOPT_STATUS_OUT_OF_MEMORY;
+
+		if (spec->type == ADOPT_TYPE_LIST)
+			list->items = items;
+		else
+			ints->items = items;
+	}
+
+	while (1) {
+		item_len = delim_scan(value, len, delim);
+
+		if (spec->type == ADOPT_TYPE_BITMASK) {
+			if ((flag = enum_lookup(parser, spec, value, item_len)) == NULL)
+				return ADOPT_STATUS_UNKNOWN_VALUE;
+
+			mask |= flag->value;
+		} else if (spec->type == ADOPT_TYPE_INT_LIST) {
+			/* Drop the items of a value that can't be converted */
+			if ((status = parse_integer(&n, ADOPT_TYPE_INT64,
+					value, item_len)) != ADOPT_STATUS_OK) {
+				if (target)
+					ints->len -= given;
+
+				return status;
+			}
+
+			given++;
+
+			if (target)
+				ints->items[ints->len++] = n;
+		} else if (target) {
+			list->items[list->len].ptr = value;
+			list->items[list->len++].len = item_len;
+		}
+
+		if (item_len == len)
+			break;
+
+		value += item_len + 1;
+		len -= item_len + 1;
+	}
+
+	if (target && spec->type == ADOPT_TYPE_BITMASK)
+		*((int *)target) |= mask;
+
+	return ADOPT_STATUS_OK;
+}
+
+/*
+ * Values read from a source are only valid until the next argument is
+ * read, so the types that collect them need them to be copied.
+ */
+#define source_cannot_collect(parser, spec) \
+	((parser)->source && \
+	 !((parser)->flags & ADOPT_PARSE_COPY_VALUES) && \
+	 ((spec)->type == ADOPT_TYPE_VALUES || \
+	  (spec)->type == ADOPT_TYPE_KEY_VALUES || \
+	  (spec)->type == ADOPT_TYPE_LIST))
+
+/*
+ * Set a sub-option in the given target; `value` is NULL when the item
+ * has no '='.
+ */
+static adopt_status_t subopt_set(
+	const adopt_parser *parser,
+	const adopt_spec *sub,
+	void *target,
+	char *value,
+	size_t len)
+{
+	const adopt_enum_value *found;
+
+	if (!spec_is_subopt_type(sub))
+		return ADOPT_STATUS_INVALID_VALUE;
+
+	if (sub->type == ADOPT_TYPE_BOOL ||
+	    sub->type == ADOPT_TYPE_SWITCH ||
+	    sub->type == ADOPT_TYPE_ACCUMULATOR) {
+		if (value)
+			return ADOPT_STATUS_INVALID_VALUE;
+
+		if (target && sub->type == ADOPT_TYPE_BOOL)
+			*((int *)target) = 1;
+		else if (target && sub->type == ADOPT_TYPE_SWITCH)
+			*((int *)target) = sub->switch_value;
+		else if (target)
+			*((int *)target) += sub->switch_value ? sub->switch_value : 1;
+
+		return ADOPT_STATUS_OK;
+	}
+
+	if (!value)
+		return ADOPT_STATUS_MISSING_VALUE;
+
+	if (spec_is_numeric(sub))
+		return numeric_set(target, sub->type, value, len);
+
+	if (target && source_cannot_collect(parser, sub))
+		return ADOPT_STATUS_UNSUPPORTED_FLAGS;
+
+	if (spec_is_list(sub))
+		return list_set(parser, sub, target, value, len);
+
+	if (sub->type == ADOPT_TYPE_ENUM) {
+		if ((found = enum_lookup(parser, sub, value, len)) == NULL)
+			return ADOPT_STATUS_UNKNOWN_VALUE;
+
+		if (target)
+			*((int *)target) = found->value;
+	} else if (sub->type == ADOPT_TYPE_VALUE && target) {
+		((adopt_slice *)target)->ptr = value;
+		((adopt_slice *)target)->len = len;
+	}
+
+	return ADOPT_STATUS_OK;
+}
+
+/*
+ * Split an `ADOPT_TYPE_SUBOPTS` value into its items, and set each
+ * sub-option; the delimiters and the '=' in each item are found with
+ * the same scan as lists.  With a result block, each sub-option is
+ * stored in the block that the caller gave in the spec's result.
+ */
+static adopt_status_t subopts_set(
+	const adopt_parser *parser,
+	const adopt_spec *spec,
+	void *target,
+	char *value,
+	size_t len)
+{
+	const adopt_spec *sub;
+	adopt_value *results = NULL;
+	char delim = spec->switch_value ? (char)spec->switch_value : ',';
+	size_t item_len, key_len;
+	adopt_status_t status;
+
+	if (parser->results && target)
+		results = ((adopt_value *)target)->sub;
+
+	while (1) {
+		item_len = delim_scan(value, len, delim);
+		key_len = delim_scan(value, item_len, '=');
+
+		if ((sub = subopt_lookup(parser, spec, value, key_len)) == NULL)
+			return ADOPT_STATUS_UNKNOWN_VALUE;
+
+		if ((status = subopt_set(parser, sub,
+				parser->results ?
+				 (results ? &results[sub - spec_subopts(spec)] : NULL) :
+				 spec_bound(parser, sub->value),
+				(key_len < item_len) ? &value[key_len + 1] : NULL,
+				(key_len < item_len) ? item_len - key_len - 1 : 0)) != ADOPT_STATUS_OK)
+			return status;
+
+		if (item_len == len)
+			break;
+
+		value += item_len + 1;
+		len -= item_len + 1;
+	}
+
+	return ADOPT_STATUS_OK;
+}
+
+/*
+ * Set the value in the opt, and in the spec's target; the values of an
+ * `ADOPT_TYPE_VALUES` are collected (as slices, when parsing slices,
+ * since they aren't NUL-terminated), the values of numeric and enum options are
+ * converted, and lists and sub-options are split.
+ */
+INLINE(adopt_status_t) opt_set_value(
+	adopt_opt *opt,
+	const adopt_parser *parser,
+	const adopt_spec *spec,
+	void *target,
+	char *value,
+	size_t len)
+{
+	const adopt_enum_value *found;
+
+	if (target && source_cannot_collect(parser, spec))
+		return ADOPT_STATUS_UNSUPPORTED_FLAGS;
+
+	if (value_copy(&value, parser, value, len) < 0)
+		return ADOPT_STATUS_OUT_OF_MEMORY;
+
+	opt->value = value;
+	opt->value_len = (parser->slices && value) ? len : 0;
+
+	if (spec_is_numeric(spec))
+		return value ? numeric_set(target, spec->type, value,
+			parser->slices ? len : strlen(value)) : ADOPT_STATUS_OK;
+
+	if (spec_is_list(spec))
+		return value ? list_set(parser, spec, target, value,
+			parser->slices ? len : strlen(value)) : ADOPT_STATUS_OK;
+
+	if (spec->type == ADOPT_TYPE_SUBOPTS)
+		return value ? subopts_set(parser, spec, target, value,
+			parser->slices ? len : strlen(value)) : ADOPT_STATUS_OK;
+
+	if (spec->type == ADOPT_TYPE_KEY_VALUES) {
+		if (target && value && key_values_append(parser, spec, target,
+				value, parser->slices ? len : strlen(value)) < 0)
+			return ADOPT_STATUS_OUT_OF_MEMORY;
+
+		return ADOPT_STATUS_OK;
+	}
+
+	if (spec->type == ADOPT_TYPE_ENUM && value) {
+		if ((found = enum_lookup(parser, spec, value,
+				parser->slices ? len : strlen(value))) == NULL)
+			return ADOPT_STATUS_UNKNOWN_VALUE;
+
+		if (target)
+			*((int *)target) = found->value;
+
+		return ADOPT_STATUS_OK;
+	}
+
+	if (spec->type == ADOPT_TYPE_VALUES) {
+		if (target && value &&
+		    values_append(parser, spec, target, value, len) < 0)
+			return ADOPT_STATUS_OUT_OF_MEMORY;
+	} else {
+		target_set_value(target, parser, value, len);
+	}
+
+	return ADOPT_STATUS_OK;
+}
+
+INLINE(char *) opt_set_arg(
+	adopt_opt *opt,
+	size_t *len,
+	const adopt_parser *parser,
+	size_t idx)
+{
+	opt->arg = parser_arg(len, parser, idx);
+	opt->arg_len = parser->slices ? *len : 0;
+
+	return opt->arg;
+}
+
+/*
+ * Take the words following an option as its value; they're stored
+ * in place, as a range of the arguments.  When they'll be moved by
+ * sorting, the parser remembers to update the range.
+ */
+static adopt_status_t opt_set_words(
+	adopt_parser *parser,
+	const adopt_spec *spec,
+	void *target)
+{
+	adopt_words *words = target;
+	size_t start = parser->idx, count;
+
+	if (parser->source)
+		return ADOPT_STATUS_MISSING_VALUE;
+
+	if (words_count(&count, parser, spec, start) < 0) {
+		parser->idx = parser->args_len;
+		return ADOPT_STATUS_MISSING_VALUE;
+	}
+
+	parser->idx += count + (spec->type == ADOPT_TYPE_WORDS_UNTIL);
+
+	if (!words)
+		return ADOPT_STATUS_OK;
+
+	words->args = NULL;
+	words->slices = NULL;
+	words->len = count;
+
+	if ((parser->flags & ADOPT_PARSE_COPY_VALUES)) {
+		if (args_copy(parser->slices ? (void *)&words->slices : (void *)&words->args,
+				parser, start, count) < 0)
+			return ADOPT_STATUS_OUT_OF_MEMORY;
+	} else if (parser->slices) {
+		words->slices = &parser->slices[start];
+	} else {
+		words->args = &parser->args[start];
+
+		if (parser->in_gnu_opts &&
+		    !(parser->flags & ADOPT_PARSE_PRESERVE_ARGS))
+			parser->sort_words = 1;
+	}
+
+	return ADOPT_STATUS_OK;
+}
+
+static adopt_status_t parse_long(adopt_opt *opt, adopt_parser *parser)
+{
+	const adopt_spec *spec;
+	const char *value = NULL;
+	char *arg;
+	void *target;
+	size_t len, value_len;
+	adopt_tag tag = parser_tag(parser, parser->idx);
+	const adopt_spec *const *matched = parser_matched(parser, parser->idx);
+	int is_negated = 0, has_value = 0;
+
+	arg = opt_set_arg(opt, &len, parser, parser->idx++);
+
+	if (len != ARG_TERMINATED)
+		len -= 2;
+
+	if ((spec = spec_for_long(&is_negated, &has_value, &value, parser,
+			&arg[2], len, tag, matched)) == NULL) {
+		opt->spec = NULL;
+		opt->status = ADOPT_STATUS_UNKNOWN_OPTION;
+		goto done;
+	}
+
+	opt->spec = spec;
+	target = spec_target(parser, spec);
+
+	/* Future options parsed as literal */
+	if (spec->type == ADOPT_TYPE_LITERAL)
+		parser->in_literal = 1;
+
+	/* --bool or --no-bool */
+	else if (spec->type == ADOPT_TYPE_BOOL && target)
+		*((int *)target) = !is_negated;
+
+	/* --accumulate */
+	else if (spec->type == ADOPT_TYPE_ACCUMULATOR && target)
+		*((int *)target) += spec->switch_value ? spec->switch_value : 1;
+
+	/* --switch */
+	else if (spec->type == ADOPT_TYPE_SWITCH && target)
+		*((int *)target) = spec->switch_value;
+
+	/* Parse words as "--foo x y z" */
+	else if (spec_takes_words(spec)) {
+		if ((opt->status = opt_set_words(parser, spec, target)) != ADOPT_STATUS_OK)
+			goto done;
+	}
+
+	/* Parse values as "--foo=bar" or "--foo bar" */
+	else if (spec_takes_value(spec)) {
+		if (has_value) {
+			value_len = value ? len - (size_t)(value - &arg[2]) : 0;
+		} else if ((parser->idx + 1) <= parser->args_len) {
+			value = parser_arg(&value_len, parser, parser->idx++);
+		} else {
+			value_len = 0;
+		}
+
+		if ((opt->status = opt_set_value(opt, parser, spec, target,
+				(char *)value, value_len)) != ADOPT_STATUS_OK)
+			goto done;
+	}
+
+	/* Required argument was not provided */
+	if (spec_takes_value(spec) &&
+	    !opt->value &&
+	    !(spec->usage & ADOPT_USAGE_VALUE_OPTIONAL))
+		opt->status = ADOPT_STATUS_MISSING_VALUE;
+	else
+		opt->status = ADOPT_STATUS_OK;
+
+	consume_choices(opt->spec, parser);
+
+done:
+	return opt->status;
+}
+
+INLINE(int) spec_is_flag_type(const adopt_spec *spec)
+{
+	return (spec->type == ADOPT_TYPE_BOOL ||
+	        spec->type == ADOPT_TYPE_ACCUMULATOR ||
+	        spec->type == ADOPT_TYPE_SWITCH);
+}
+
+INLINE(void) apply_short_flag(
+	const adopt_parser *parser,
+	const adopt_spec *spec)
+{
+	void *target = spec_target(parser, spec);
+
+	if (!target)
+		return;
+
+	if (spec->type == ADOPT_TYPE_BOOL)
+		*((int *)target) = 1;
+
+	else if (spec->type == ADOPT_TYPE_ACCUMULATOR)
+		*((int *)target) += spec->switch_value ? spec->switch_value : 1;
+
+	else if (spec->type == ADOPT_TYPE_SWITCH)
+		*((int *)target) = spec->switch_value;
+}
+
+static adopt_status_t parse_short(adopt_opt *opt, adopt_parser *parser)
+{
+	const adopt_spec *spec;
+	const char *value;
+	char *arg, *attached = NULL;
+	void *target;
+	size_t len, rest, value_len;
+
+	arg = opt_set_arg(opt, &len, parser, parser->idx);
+	rest = (len == ARG_TERMINATED) ? len : len - (1 + parser->in_short);
+
+	spec = spec_for_short(&value, parser, &arg[1 + parser->in_short], rest,
+		parser->in_short ? NULL : parser_matched(parser, parser->idx));
+
+	/* Words can't be attached to the option, as in "-pX" */
+	if (spec && spec_takes_words(spec) &&
+	    arg_has(arg, len, 2 + parser->in_short))
+		attached = &arg[2 + parser->in_short];
+
+	/*
+	 * Handle compressed short arguments, like "-fbcd"; stay on this
+	 * argument while there's another character after the one we
+	 * processed.  A value (or words) consumes the remainder of the
+	 * argument, and an unknown option abandons it.
+	 */
+	if (spec && !spec_takes_value(spec) && !spec_takes_words(spec) &&
+	    arg_has(arg, len, 2 + parser->in_short)) {
+		parser->in_short++;
+	} else {
+		parser->in_short = 0;
+		parser->idx++;
+	}
+
+	if (!spec) {
+		opt->spec = NULL;
+		opt->status = ADOPT_STATUS_UNKNOWN_OPTION;
+		goto done;
+	}
+
+	opt->spec = spec;
+
+	if (spec_is_flag_type(spec))
+		apply_short_flag(parser, spec);
+
+	/* Parse words as "-i x y z" */
+	else if (spec_takes_words(spec)) {
+		if (attached) {
+			opt->value = attached;
+			opt->value_len = parser->slices ? rest - 1 : 0;
+			opt->status = ADOPT_STATUS_INVALID_VALUE;
+			goto done;
+		}
+
+		if ((opt->status = opt_set_words(parser, spec,
+				spec_target(parser, spec))) != ADOPT_STATUS_OK)
+			goto done;
+	}
+
+	/* Parse values as "-ifoo" or "-i foo" */
+	else if (spec_takes_value(spec)) {
+		target = spec_target(parser, spec);
+
+		if (value)
+			value_len = rest - 1;
 		else if ((parser->idx + 1) <= parser->args_len)
-			opt->value = parser->args[parser->idx++];
+			value = parser_arg(&value_len, parser, parser->idx++);
+		else
+			value_len = 0;
+
+		if ((opt->status = opt_set_value(opt, parser, spec, target,
+				(char *)value, value_len)) != ADOPT_STATUS_OK)
+			goto done;
+	}
+
+	/* Required argument was not provided */
+	if (spec_takes_value(spec) && !opt->value)
+		opt->status = ADOPT_STATUS_MISSING_VALUE;
+	else
+		opt->status = ADOPT_STATUS_OK;
+
+	consume_choices(opt->spec, parser);
+
+done:
+	return opt->status;
+}
+
+/* Bitset of given specs, indexed by position in the spec array */
+#define GIVEN_BUFFER_LEN 32
+
+INLINE(void) given_set(
+	unsigned char *given,
+	const adopt_spec specs[],
+	const adopt_spec *spec)
+{
+	size_t pos = (size_t)(spec - specs);
+	given[pos / CHAR_BIT] |= (unsigned char)(1u << (pos % CHAR_BIT));
+}
+
+INLINE(int) given_test(
+	const unsigned char *given,
+	const adopt_spec specs[],
+	const adopt_spec *spec)
+{
+	size_t pos = (size_t)(spec - specs);
+	return (given[pos / CHAR_BIT] >> (pos % CHAR_BIT)) & 1;
+}
+
+/*
+ * Whether the parser will fail before parsing anything, because its
+ * response files couldn't be expanded or its flags can't be honoured.
+ */
+INLINE(int) parser_failed(const adopt_parser *parser)
+{
+	return parser->invalid_flags ||
+	       ((parser->flags & ADOPT_PARSE_RESPONSE_FILES) &&
+	        parser->response_status != ADOPT_STATUS_OK);
+}
+
+/*
+ * Apply a cluster of short flags, like "-xvzf", in a single pass.
+ * Each character is looked up and applied in turn; this stops at the
+ * first character that needs the full treatment of `parse_short`
+ * (a value, an unknown option, a choice or a stop) and leaves the
+ * parser positioned on it.  The applied specs are marked in the
+ * `given` bitset.
+ */
+static void parse_short_flags(
+	unsigned char *given,
+	adopt_parser *parser)
+{
+	const adopt_spec *spec;
+	const char *arg, *value;
+	size_t applied = 0;
+
+	/*
+	 * After the first bare argument in GNU mode, the parser skips
+	 * around the arguments (and, when preserving them, walks back
+	 * over the options already parsed); leave that to the parser.
+	 */
+	if (parser->idx >= parser->args_len || parser->in_literal ||
+	    parser->in_short || parser->in_gnu_opts || parser->in_gnu_args ||
+	    parser_failed(parser) ||
+	    (parser->tags &&
+	     ADOPT_TAG_KIND(parser->tags[parser->idx]) != ADOPT_TAG_SHORT))
+		return;
+
+	arg = parser->args[parser->idx];
+
+	if (arg[0] != '-' || arg[1] == '-' || arg[1] == '\0' || arg[2] == '\0')
+		return;
+
+	for (arg++; *arg; arg++) {
+		spec = spec_for_short(&value, parser, arg, ARG_TERMINATED, NULL);
+
+		if (!spec || !spec_is_flag_type(spec) ||
+		    (spec->usage & (ADOPT_USAGE_STOP_PARSING | ADOPT_USAGE_CHOICE)) ||
+		    spec_is_choice(spec))
+			break;
+
+		apply_short_flag(parser, spec);
+		given_set(given, parser->specs, spec);
+		applied++;
+	}
+
+	if (!*arg)
+		parser->idx++;
+	else
+		parser->in_short = applied;
+}
+
+/*
+ * Count the bare arguments that remain when not reordering: those up
+ * to the end of the options (skipping the options themselves), and
+ * everything afterward.
+ */
+static size_t count_gnu_args(const adopt_parser *parser)
+{
+	size_t idx, len, count = 0;
+
+	for (idx = parser->idx; idx < parser->bare_stop; idx += len) {
+		if (sort_classify(&len, parser, idx) == SORT_BARE)
+			count++;
+	}
+
+	return count + (parser->args_len - parser->bare_stop);
+}
+
+static void args_iter_init(adopt_args_iter *iter, const adopt_parser *parser)
+{
+	/* Slices have no NUL-terminated arguments to iterate */
+	if (parser->slices) {
+		memset(iter, 0x0, sizeof(adopt_args_iter));
+		return;
+	}
+
+	iter->specs = parser->specs;
+	iter->index = parser->index;
+	iter->args = parser->args;
+	iter->args_len = parser->args_len;
+	iter->idx = parser->in_args ? parser->args_idx : parser->args_len;
+	iter->stop = parser->in_args ? parser->args_stop : parser->args_len;
+}
+
+char *adopt_args_next(adopt_args_iter *iter)
+{
+	adopt_parser parser;
+	size_t len;
+
+	assert(iter);
+
+	if (iter->idx < iter->stop) {
+		memset(&parser, 0x0, sizeof(adopt_parser));
+		parser.specs = iter->specs;
+		parser.index = iter->index;
+		parser.args = iter->args;
+		parser.args_len = iter->args_len;
+
+		while (iter->idx < iter->stop &&
+		       sort_classify(&len, &parser, iter->idx) != SORT_BARE)
+			iter->idx += len;
+	}
+
+	return (iter->idx < iter->args_len) ? iter->args[iter->idx++] : NULL;
+}
+
+static adopt_status_t parse_arg(adopt_opt *opt, adopt_parser *parser)
+{
+	const adopt_spec *spec = spec_for_arg(parser);
+	void *target;
+	char *value;
+	size_t len;
+
+	opt->spec = spec;
+	opt_set_arg(opt, &len, parser, parser->idx);
+
+	if (!spec) {
+		parser->idx++;
+		opt->status = ADOPT_STATUS_UNKNOWN_OPTION;
+	} else if (spec->type == ADOPT_TYPE_ARGS) {
+		parser->args_idx = parser->idx;
+
+		/*
+		 * Without reordering, options given after the first bare
+		 * argument are still interleaved with the remaining
+		 * arguments; those are skipped by the iterator.
+		 */
+		if (parser->in_gnu_args) {
+			parser->args_stop = parser->bare_stop;
+			parser->in_args = count_gnu_args(parser);
+			parser->in_gnu_args = 0;
+		} else {
+			parser->args_stop = parser->idx;
+			parser->in_args = (parser->args_len - parser->idx);
+
+			if ((target = spec_target(parser, spec)) != NULL &&
+			    (parser->flags & ADOPT_PARSE_COPY_VALUES)) {
+				if (args_copy(target, parser, parser->idx,
+						parser->args_len - parser->idx) < 0) {
+					parser->idx = parser->args_len;
+					return (opt->status = ADOPT_STATUS_OUT_OF_MEMORY);
+				}
+			} else if (target && parser->slices)
+				*((const adopt_slice **)target) = &parser->slices[parser->idx];
+			else if (target)
+				*((char ***)target) = &parser->args[parser->idx];
+		}
+
+		/*
+		 * We have started a list of arguments; the remainder of
+		 * given arguments need not be examined.
+		 */
+		parser->idx = parser->args_len;
+		opt->args_len = parser->in_args;
+		args_iter_init(&opt->args, parser);
+		opt->status = ADOPT_STATUS_OK;
+	} else {
+		parser->idx++;
+
+		if (value_copy(&value, parser, opt->arg, len) < 0)
+			return (opt->status = ADOPT_STATUS_OUT_OF_MEMORY);
+
+		target_set_value(spec_target(parser, spec), parser, value, len);
+		opt->status = ADOPT_STATUS_OK;
+	}
+
+	return opt->status;
+}
+
+static int posixly_correct(void)
+{
+	/* TODO: Windows */
+#if defined(_WIN32) && defined(UNICODE)
+	return (_wgetenv(L"POSIXLY_CORRECT") != NULL);
+#else
+	return (getenv("POSIXLY_CORRECT") != NULL);
+#endif
+}
+
+static int support_gnu_style(unsigned int flags, const adopt_index *index)
+{
+	if ((flags & ADOPT_PARSE_FORCE_GNU) != 0)
+		return 1;
+
+	if ((flags & ADOPT_PARSE_GNU) == 0)
+		return 0;
+
+	if (index ? index->posixly_correct : posixly_correct())
+		return 0;
+
+	return 1;
+}
+
+/*
+ * Response files ("@file") are memory-mapped privately, so that they
+ * can be tokenized in place: quotes and escapes are removed by moving
+ * the remainder of a token down, and each token is terminated with a
+ * NUL over its delimiter.  The resulting arguments point into the
+ * mappings, which are kept until the response is freed.
+ */
+#define RESPONSE_MAX_DEPTH 32
+
+typedef struct response_map {
+	char *data;
+	size_t len;
+
+	/* A copy of a final token that runs to the end of the file */
+	char *tail;
+
+	struct response_map *next;
+} response_map;
+
+/* Identifies a file, to detect response files that include themselves */
+typedef struct {
+#ifdef _WIN32
+	DWORD volume;
+	DWORD index_high;
+	DWORD index_low;
+#else
+	dev_t dev;
+	ino_t ino;
+#endif
+} response_id;
+
+struct adopt_response {
+	char **args;
+	size_t args_len;
+	size_t args_size;
+
+	response_map *maps;
+
+	/* The response files currently being expanded */
+	response_id ids[RESPONSE_MAX_DEPTH];
+	size_t depth;
+
+	adopt_status_t status;
+	char *error_arg;
+};
+
+static int response_push(adopt_response *response, char *arg)
+{
+	char **args;
+	size_t size;
+
+	if (response->args_len == response->args_size) {
+		size = response->args_size ? response->args_size * 2 : 16;
+
+		if (size < response->args_size ||
+		    (args = realloc(response->args, size * sizeof(char *))) == NULL) {
+			response->status = ADOPT_STATUS_OUT_OF_MEMORY;
+			return -1;
+		}
+
+		response->args = args;
+		response->args_size = size;
+	}
+
+	response->args[response->args_len++] = arg;
+	return 0;
+}
+
+#ifdef _WIN32
+
+static int response_map_file(response_map *map, response_id *id, const char *path)
+{
+	BY_HANDLE_FILE_INFORMATION info;
+	HANDLE file, mapping = NULL;
+	unsigned long long len;
+	int error = -1;
+
+	file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+
+	if (file == INVALID_HANDLE_VALUE)
+		return -1;
+
+	if (!GetFileInformationByHandle(file, &info))
+		goto done;
+
+	id->volume = info.dwVolumeSerialNumber;
+	id->index_high = info.nFileIndexHigh;
+	id->index_low = info.nFileIndexLow;
+
+	len = ((unsigned long long)info.nFileSizeHigh << 32) | info.nFileSizeLow;
+
+	if (len > (size_t)-1)
+		goto done;
+
+	if ((map->len = (size_t)len) == 0) {
+		error = 0;
+		goto done;
+	}
+
+	if ((mapping = CreateFileMappingA(file, NULL, PAGE_WRITECOPY, 0, 0, NULL)) == NULL ||
+	    (map->data = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0)) == NULL)
+		goto done;
+
+	error = 0;
+
+done:
+	if (mapping)
+		CloseHandle(mapping);
+
+	CloseHandle(file);
+	return error;
+}
+
+static void response_unmap_file(response_map *map)
+{
+	if (map->data)
+		UnmapViewOfFile(map->data);
+}
+
+INLINE(int) response_id_equal(const response_id *a, const response_id *b)
+{
+	return (a->volume == b->volume &&
+	        a->index_high == b->index_high &&
+	        a->index_low == b->index_low);
+}
+
+#else
+
+static int response_map_file(response_map *map, response_id *id, const char *path)
+{
+	struct stat st;
+	void *data;
+	int fd, error = -1;
+
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return -1;
+
+	if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) ||
+	    (unsigned long long)st.st_size > (size_t)-1)
+		goto done;
+
+	id->dev = st.st_dev;
+	id->ino = st.st_ino;
+
+	if ((map->len = (size_t)st.st_size) == 0) {
+		error = 0;
+		goto done;
+	}
+
+	/* A private mapping, so that tokenizing doesn't modify the file */
+	data = mmap(NULL, map->len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+
+	if (data == MAP_FAILED)
+		goto done;
+
+	map->data = data;
+	error = 0;
+
+done:
+	close(fd);
+	return error;
+}
+
+static void response_unmap_file(response_map *map)
+{
+	if (map->data)
+		munmap(map->data, map->len);
+}
+
+INLINE(int) response_id_equal(const response_id *a, const response_id *b)
+{
+	return (a->dev == b->dev && a->ino == b->ino);
+}
+
+#endif
+
+INLINE(int) response_is_space(char c)
+{
+	return (c == ' ' || c == '\t' || c == '\n' ||
+	        c == '\r' || c == '\v' || c == '\f');
+}
+
+static int response_expand_arg(adopt_response *response, char *arg);
+
+/*
+ * Split the mapped file into arguments, in place.  Arguments are
+ * separated by whitespace; single quotes preserve everything up to
+ * the closing quote, while within double quotes a backslash escapes a
+ * double quote or a backslash.  Outside of quotes, a backslash escapes
+ * any character.  An unterminated quote makes the file invalid.
+ */
+static int response_tokenize(adopt_response *response, response_map *map)
+{
+	char *in = map->data, *end = map->data + map->len, *out, *token;
+	char quote;
+	size_t len;
+
+	while (in < end) {
+		if (response_is_space(*in)) {
+			in++;
+			continue;
+		}
+
+		for (token = out = in, quote = 0; in < end; ) {
+			if (quote == '\'' && *in == '\'') {
+				quote = 0;
+				in++;
+			} else if (quote == '\'') {
+				*out++ = *in++;
+			} else if (quote == '"' && *in == '"') {
+				quote = 0;
+				in++;
+			} else if (quote == '"') {
+				if (*in == '\\' && in + 1 < end &&
+				    (in[1] == '"' || in[1] == '\\'))
+					in++;
+
+				*out++ = *in++;
+			} else if (response_is_space(*in)) {
+				break;
+			} else if (*in == '\'' || *in == '"') {
+				quote = *in++;
+			} else {
+				if (*in == '\\' && in + 1 < end)
+					in++;
+
+				*out++ = *in++;
+			}
+		}
+
+		if (quote) {
+			response->status = ADOPT_STATUS_INVALID_RESPONSE_FILE;
+			return -1;
+		}
+
+		/*
+		 * Terminate the token over its delimiter (or a character
+		 * that was removed); a token that fills the remainder of
+		 * the file must be copied, since there's no room.
+		 */
+		if (out < end) {
+			*out = '\0';
+		} else {
+			len = (size_t)(out - token);
+
+			if ((map->tail = malloc(len + 1)) == NULL) {
+				response->status = ADOPT_STATUS_OUT_OF_MEMORY;
+				return -1;
+			}
+
+			memcpy(map->tail, token, len);
+			map->tail[len] = '\0';
+			token = map->tail;
+		}
+
+		if (in < end)
+			in++;
+
+		if (response_expand_arg(response, token) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+static int response_expand_file(adopt_response *response, char *arg)
+{
+	response_map *map;
+	response_id id;
+	size_t i;
+	int error;
+
+	if ((map = calloc(1, sizeof(response_map))) == NULL) {
+		response->status = ADOPT_STATUS_OUT_OF_MEMORY;
+		return -1;
+	}
+
+	map->next = response->maps;
+	response->maps = map;
+
+	if (response->depth == RESPONSE_MAX_DEPTH ||
+	    response_map_file(map, &id, &arg[1]) < 0)
+		goto invalid;
+
+	for (i = 0; i < response->depth; i++) {
+		if (response_id_equal(&response->ids[i], &id))
+			goto invalid;
+	}
+
+	response->ids[response->depth++] = id;
+	error = response_tokenize(response, map);
+	response->depth--;
+
+	/* Report the innermost file that couldn't be tokenized */
+	if (error < 0 && !response->error_arg &&
+	    response->status == ADOPT_STATUS_INVALID_RESPONSE_FILE)
+		response->error_arg = arg;
+
+	return error;
+
+invalid:
+	response->status = ADOPT_STATUS_INVALID_RESPONSE_FILE;
+	response->error_arg = arg;
+	return -1;
+}
+
+static int response_expand_arg(adopt_response *response, char *arg)
+{
+	if (arg[0] == '@' && arg[1] != '\0')
+		return response_expand_file(response, arg);
+
+	return response_push(response, arg);
+}
+
+adopt_status_t adopt_response_expand(
+	adopt_response **out,
+	adopt_opt *opt,
+	char **args,
+	size_t args_len)
+{
+	adopt_response *response;
+	size_t i;
+
+	assert(out && opt && (args || !args_len));
+
+	memset(opt, 0x0, sizeof(adopt_opt));
+
+	if ((*out = response = calloc(1, sizeof(adopt_response))) == NULL)
+		return (opt->status = ADOPT_STATUS_OUT_OF_MEMORY);
+
+	response->status = ADOPT_STATUS_OK;
+
+	for (i = 0; i < args_len; i++) {
+		if (response_expand_arg(response, args[i]) < 0)
+			break;
+	}
+
+	opt->arg = response->error_arg;
+	return (opt->status = response->status);
+}
+
+char **adopt_response_args(size_t *args_len, const adopt_response *response)
+{
+	assert(args_len && response);
+
+	*args_len = response->args_len;
+	return response->args;
+}
+
+void adopt_response_free(adopt_response *response)
+{
+	response_map *map, *next;
+
+	if (!response)
+		return;
+
+	for (map = response->maps; map; map = next) {
+		next = map->next;
+
+		response_unmap_file(map);
+		free(map->tail);
+		free(map);
+	}
+
+	free(response->args);
+	free(response);
+}
+
+/*
+ * Replace the parser's arguments with their expansion; a failure is
+ * reported by the first call to `adopt_parser_next`.
+ */
+static void parser_expand_responses(adopt_parser *parser)
+{
+	adopt_opt opt;
+
+	parser->response_status = adopt_response_expand(&parser->response,
+		&opt, parser->args, parser->args_len);
+
+	if (parser->response_status == ADOPT_STATUS_OK)
+		parser->args = adopt_response_args(&parser->args_len, parser->response);
+	else
+		parser->args_len = 0;
+}
+
+void adopt_parser_dispose(adopt_parser *parser)
+{
+	if (!parser)
+		return;
+
+	adopt_response_free(parser->response);
+	parser->response = NULL;
+	parser->args_len = 0;
+}
+
+void adopt_parser_init(
+	adopt_parser *parser,
+	const adopt_spec specs[],
+	char **args,
+	size_t args_len,
+	unsigned int flags)
+{
+	assert(parser);
+
+	memset(parser, 0x0, sizeof(adopt_parser));
+
+	parser->specs = specs;
+	parser->args = args;
+	parser->args_len = args_len;
+	parser->flags = flags;
+
+	parser->needs_sort = support_gnu_style(flags, NULL);
+
+	if ((flags & ADOPT_PARSE_RESPONSE_FILES))
+		parser_expand_responses(parser);
+}
+
+static void index_name_insert(
+	adopt_index *index,
+	const adopt_spec *spec,
+	int negated)
+{
+	index_name *entry;
+	const char *c;
+	uint32_t hash = INDEX_HASH_INIT;
+	size_t i;
+
+	if (negated) {
+		for (c = "no-"; *c; c++)
+			hash = INDEX_HASH(hash, *c);
+	}
+
+	for (c = spec->name ? spec->name : ""; *c; c++)
+		hash = INDEX_HASH(hash, *c);
+
+	for (i = hash & index->names_mask;
+	     index->names[i].spec;
+	     i = (i + 1) & index->names_mask)
+		;
+
+	entry = &index->names[i];
+	entry->spec = spec;
+	entry->hash = hash;
+	entry->len = spec->name ? strlen(spec->name) : 0;
+	entry->negated = !!negated;
+}
+
+static void index_key_insert(
+	adopt_index *index,
+	const adopt_spec *spec,
+	const char *name,
+	const void *item)
+{
+	index_key *entry;
+	const char *c;
+	uint32_t hash = INDEX_HASH_INIT;
+	size_t i;
+
+	for (c = name; *c; c++)
+		hash = INDEX_HASH(hash, *c);
+
+	for (i = hash & index->keys_mask;
+	     index->keys[i].spec;
+	     i = (i + 1) & index->keys_mask)
+		;
+
+	entry = &index->keys[i];
+	entry->spec = spec;
+	entry->name = name;
+	entry->item = item;
+	entry->hash = hash;
+	entry->len = (size_t)(c - name);
+}
+
+/*
+ * Count the keys that belong to a spec (and to its sub-options), and
+ * insert them once the table has been allocated.
+ */
+static size_t index_spec_keys(adopt_index *index, const adopt_spec *spec)
+{
+	const adopt_enum_value *value;
+	const adopt_spec *sub;
+	size_t count = 0;
+
+	for (value = spec_enum_values(spec); value && value->name; value++, count++) {
+		if (index->keys)
+			index_key_insert(index, spec, value->name, value);
+	}
+
+	for (sub = spec_subopts(spec); sub && sub->type; sub++) {
+		if (sub->name && index->keys)
+			index_key_insert(index, spec, sub->name, sub);
+
+		count += (sub->name ? 1 : 0) + index_spec_keys(index, sub);
+	}
+
+	return count;
+}
+
+static void index_choices(adopt_index *index)
+{
+	const adopt_spec *specs = index->specs;
+	size_t start, end, args, i;
+
+	for (start = 0; start < index->specs_len; start = end) {
+		for (end = start + 1, args = 0; end < index->specs_len &&
+		     (specs[end].usage & ADOPT_USAGE_CHOICE); end++)
+			;
+
+		/* Only a group of choices consumes its arguments */
+		for (i = start; end - start > 1 && i < end; i++) {
+			if (specs[i].type == ADOPT_TYPE_ARG)
+				args++;
+		}
+
+		for (i = start; i < end; i++) {
+			index->choices[i].start = start;
+			index->choices[i].len = end - start;
+			index->choices[i].args = args;
+		}
+	}
+}
+
+/*
+ * Sub-options can only be of the types that take (at most) one value
+ * from their item.
+ */
+static int subopts_valid(const adopt_spec *spec)
+{
+	const adopt_spec *sub;
+
+	if ((sub = spec_subopts(spec)) == NULL)
+		return 1;
+
+	for (; sub->type; ++sub) {
+		if (!spec_is_subopt_type(sub))
+			return 0;
+	}
+
+	return 1;
+}
+
+int adopt_spec_compile(adopt_index **out, const adopt_spec specs[])
+{
+	adopt_index *index;
+	const adopt_spec *spec;
+	size_t names_len = 0, names_size = 8, arg_idx;
+	size_t keys_len = 0, keys_size = 8;
+
+	assert(out && specs);
+
+	*out = NULL;
+
+	if ((index = calloc(1, sizeof(adopt_index))) == NULL)
+		return -1;
+
+	index->specs = specs;
+	index->posixly_correct = posixly_correct();
+
+	for (spec = specs; spec->type; ++spec) {
+		if (!subopts_valid(spec)) {
+			adopt_index_free(index);
+			return -1;
+		}
+
+		if (spec->type == ADOPT_TYPE_LITERAL)
+			names_len++;
+		if (spec->type == ADOPT_TYPE_BOOL && spec->name)
+			names_len++;
+		if (spec_is_option_type(spec) && spec->name)
+			names_len++;
+
+		if (spec->type == ADOPT_TYPE_ARG)
+			index->positional_len++;
+
+		keys_len += index_spec_keys(index, spec);
+		index->specs_len++;
+	}
+
+	/* One more position, where an `ADOPT_TYPE_ARGS` may follow */
+	index->positional_len++;
+
+	/* Keep the table at most half full so that probes stay short */
+	while (names_size < names_len * 2)
+		names_size <<= 1;
+
+	if ((index->names = calloc(names_size, sizeof(index_name))) == NULL) {
+		adopt_index_free(index);
+		return -1;
+	}
+
+	index->names_mask = names_size - 1;
+
+	while (keys_size < keys_len * 2)
+		keys_size <<= 1;
+
+	if (keys_len &&
+	    (index->keys = calloc(keys_size, sizeof(index_key))) == NULL) {
+		adopt_index_free(index);
+		return -1;
+	}
+
+	index->keys_mask = keys_size - 1;
+
+	if ((index->positional = calloc(index->positional_len, sizeof(adopt_spec *))) == NULL ||
+	    (index->choices = calloc(index->specs_len, sizeof(index_choice))) == NULL) {
+		adopt_index_free(index);
+		return -1;
+	}
+
+	index_choices(index);
+
+	/*
+	 * Insert in spec order so that the probe sequence for a given
+	 * name mirrors the precedence of `spec_for_long`.  A literal is
+	 * keyed on the empty name, since it is given as a bare "--".
+	 */
+	for (spec = specs, arg_idx = 0; spec->type; ++spec) {
+		/*
+		 * Like `spec_for_arg`, the first of an `ADOPT_TYPE_ARG`
+		 * or `ADOPT_TYPE_ARGS` to be reached at a position wins.
+		 */
+		if ((spec->type == ADOPT_TYPE_ARG || spec->type == ADOPT_TYPE_ARGS) &&
+		    !index->positional[arg_idx])
+			index->positional[arg_idx] = spec;
+
+		if (spec->type == ADOPT_TYPE_ARG)
+			arg_idx++;
+
+		if (!index->aliases[(unsigned char)spec->alias])
+			index->aliases[(unsigned char)spec->alias] = spec;
+
+		if (spec->type == ADOPT_TYPE_LITERAL)
+			index_name_insert(index, spec, 0);
+		if (spec->type == ADOPT_TYPE_BOOL && spec->name)
+			index_name_insert(index, spec, 1);
+		if (spec_is_option_type(spec) && spec->name)
+			index_name_insert(index, spec, 0);
+
+		index_spec_keys(index, spec);
+	}
+
+	*out = index;
+	return 0;
+}
+
+void adopt_index_free(adopt_index *index)
+{
+	if (!index)
+		return;
+
+	free(index->names);
+	free(index->positional);
+	free(index->choices);
+	free(index->keys);
+	free(index);
+}
+
+void adopt_parser_init_index(
+	adopt_parser *parser,
+	const adopt_index *index,
+	char **args,
+	size_t args_len,
+	unsigned int flags)
+{
+	adopt_parser_init_results(parser, index, NULL, args, args_len, flags);
+}
+
+void adopt_parser_init_results(
+	adopt_parser *parser,
+	const adopt_index *index,
+	adopt_value *results,
+	char **args,
+	size_t args_len,
+	unsigned int flags)
+{
+	assert(parser && index);
+
+	memset(parser, 0x0, sizeof(adopt_parser));
+
+	parser->specs = index->specs;
+	parser->index = index;
+	parser->results = results;
+	parser->args = args;
+	parser->args_len = args_len;
+	parser->flags = flags;
+
+	parser->needs_sort = support_gnu_style(flags, index);
+
+	if ((flags & ADOPT_PARSE_RESPONSE_FILES))
+		parser_expand_responses(parser);
+}
+
+size_t adopt_index_len(const adopt_index *index)
+{
+	assert(index);
+	return index->specs_len;
+}
+
+/*
+ * Sources and slices are parsed strictly in order, and have no
+ * `char **` arguments to expand response files into.
+ */
+#define INORDER_UNSUPPORTED_FLAGS \
+	(ADOPT_PARSE_GNU | ADOPT_PARSE_FORCE_GNU | ADOPT_PARSE_RESPONSE_FILES)
+
+void adopt_parser_init_source(
+	adopt_parser *parser,
+	const adopt_spec specs[],
+	adopt_source *source,
+	unsigned int flags)
+{
+	assert(parser && source && source->next);
+
+	/* Arguments are parsed as they're read, so they can't be reordered */
+	adopt_parser_init(parser, specs, NULL, 0,
+		flags & ~INORDER_UNSUPPORTED_FLAGS);
+	parser->invalid_flags = !!(flags & INORDER_UNSUPPORTED_FLAGS);
+	parser->source = source;
+}
+
+void adopt_parser_init_slices(
+	adopt_parser *parser,
+	const adopt_spec specs[],
+	const adopt_slice *args,
+	size_t args_len,
+	unsigned int flags)
+{
+	assert(parser && (args || !args_len));
+
+	/* Slices are parsed in order, and can't be reordered */
+	adopt_parser_init(parser, specs, NULL, args_len,
+		flags & ~INORDER_UNSUPPORTED_FLAGS);
+	parser->invalid_flags = !!(flags & INORDER_UNSUPPORTED_FLAGS);
+	parser->slices = args;
+}
+
+void adopt_arena_init(adopt_arena *arena, void *buf, size_t size)
+{
+	assert(arena && (buf || !size));
+
+	arena->buf = buf;
+	arena->size = size;
+	arena->len = 0;
+}
+
+void adopt_arena_reset(adopt_arena *arena)
+{
+	assert(arena);
+	arena->len = 0;
+}
+
+void adopt_parser_set_arena(adopt_parser *parser, adopt_arena *arena)
+{
+	assert(parser);
+	parser->arena = arena;
+}
+
+void adopt_parser_set_config(adopt_parser *parser, void *config)
+{
+	assert(parser);
+	parser->config = config;
+}
+
+int adopt_parser_classify(adopt_parser *parser, adopt_tag *tags)
+{
+	assert(parser && (tags || !parser->args_len));
+
+	if (parser->source || parser->slices)
+		return -1;
+
+	classify_args(tags, parser->args, parser->args_len);
+	parser->tags = tags;
+
+	return 0;
+}
+
+/*
+ * Parse a bare argument from a source.  The arguments for an
+ * `ADOPT_TYPE_ARGS` are returned one at a time, since they are not
+ * retained.
+ */
+static adopt_status_t parse_source_arg(adopt_opt *opt, adopt_parser *parser)
+{
+	const adopt_spec *spec = spec_for_arg(parser);
+	void *target;
+	char *value;
+
+	opt->spec = spec;
+	opt->arg = parser->args[parser->idx++];
+
+	if (!spec) {
+		opt->status = ADOPT_STATUS_UNKNOWN_OPTION;
+	} else if (spec->type == ADOPT_TYPE_ARGS) {
+		opt->args_len = ++parser->in_args;
+		opt->status = ADOPT_STATUS_OK;
+	} else {
+		if (value_copy(&value, parser, opt->arg, 0) < 0)
+			return (opt->status = ADOPT_STATUS_OUT_OF_MEMORY);
+
+		if ((target = spec_target(parser, spec)) != NULL)
+			*((char **)target) = value;
+
+		opt->status = ADOPT_STATUS_OK;
+	}
+
+	return opt->status;
+}
+
+/*
+ * Parse the next argument from a source.  The parser looks at a window
+ * of (at most) the current argument and the one following it, which
+ * may be its value; arguments are read into the window as it's
+ * consumed, so only those two need to remain valid.  A failure to read
+ * the following argument is reported once the window is exhausted.
+ */
+static adopt_status_t source_next(adopt_opt *opt, adopt_parser *parser)
+{
+	char *arg;
+	int error;
+
+	while (!parser->in_short && !parser->source_eof &&
+	       parser->window_len < 2) {
+		if ((error = parser->source->next(&arg, parser->source)) != 1) {
+			parser->source_eof = 1;
+			parser->source_failed = (error < 0);
+		} else {
+			parser->window[parser->window_len++] = arg;
+		}
+	}
+
+	if (parser->window_len == 0)
+		return (opt->status = parser->source_failed ?
+			ADOPT_STATUS_SOURCE_ERROR : ADOPT_STATUS_DONE);
+
+	parser->args = parser->window;
+	parser->args_len = parser->window_len;
+	parser->idx = 0;
+
+	arg = parser->window[0];
+
+	if (parser->in_literal)
+		parse_source_arg(opt, parser);
+	else if (arg[0] == '-' && arg[1] == '-' && !parser->in_short)
+		parse_long(opt, parser);
+	else if (parser->in_short || arg[0] == '-')
+		parse_short(opt, parser);
+	else
+		parse_source_arg(opt, parser);
+
+	/* Drop the consumed arguments from the window */
+	if (parser->idx == 1)
+		parser->window[0] = parser->window[1];
+
+	parser->window_len -= parser->idx;
+
+	return opt->status;
+}
+
+static int fd_source_next(char **out, adopt_source *s)
+{
+	adopt_fd_source *source = (adopt_fd_source *)s;
+	char *buf = source->buf[source->current], *delim;
+	size_t len;
+	long ret;
+
+	for (;;) {
+		if ((delim = memchr(buf + source->scan, source->delimiter,
+		                    source->end - source->scan)) != NULL) {
+			*delim = '\0';
+			*out = buf + source->start;
+			source->start = source->scan = (size_t)(delim - buf) + 1;
+			return 1;
+		}
+
+		source->scan = source->end;
+
+		/* The last argument may not be followed by a delimiter */
+		if (source->eof) {
+			if (source->start == source->end)
+				return 0;
+
+			if (source->end - source->start == source->buf_size)
+				return -1;
+
+			buf[source->end] = '\0';
+			*out = buf + source->start;
+			source->start = source->end;
+			return 1;
+		}
+
+		/*
+		 * When the buffer is full, move the partial argument to
+		 * the other buffer, so that the argument read most
+		 * recently stays where it is.
+		 */
+		if (source->end == source->buf_size) {
+			len = source->end - source->start;
+
+			if (len == source->buf_size)
+				return -1;
+
+			source->current = !source->current;
+			memcpy(source->buf[source->current], buf + source->start, len);
+
+			buf = source->buf[source->current];
+			source->start = 0;
+			source->scan = source->end = len;
+		}
+
+		do {
+#ifdef _WIN32
+			ret = _read(source->fd, buf + source->end,
+				(unsigned int)(source->buf_size - source->end));
+#else
+			ret = (long)read(source->fd, buf + source->end,
+				source->buf_size - source->end);
+#endif
+		} while (ret < 0 && errno == EINTR);
 
-		if (spec->value)
-			*((char **)spec->value) = opt->value;
+		if (ret < 0)
+			return -1;
+		else if (ret == 0)
+			source->eof = 1;
+		else
+			source->end += (size_t)ret;
 	}
+}
 
-	/* Required argument was not provided */
-	if (spec->type == ADOPT_TYPE_VALUE &&
-	    !opt->value &&
-	    !(spec->usage & ADOPT_USAGE_VALUE_OPTIONAL))
-		opt->status = ADOPT_STATUS_MISSING_VALUE;
+int adopt_fd_source_init(
+	adopt_fd_source *source,
+	int fd,
+	char delimiter,
+	size_t max_len)
+{
+	assert(source);
+
+	memset(source, 0x0, sizeof(adopt_fd_source));
+
+	if (!max_len)
+		max_len = ADOPT_FD_SOURCE_MAX_LEN;
+
+	/*
+	 * Two buffers, each with room for an argument and its delimiter,
+	 * and for a terminating NUL when the last argument has none.
+	 */
+	if (max_len > ((size_t)-1 / 2) - 2 ||
+	    (source->buf[0] = malloc((max_len + 2) * 2)) == NULL)
+		return -1;
+
+	source->buf[1] = source->buf[0] + max_len + 2;
+	source->buf_size = max_len + 1;
+	source->fd = fd;
+	source->delimiter = delimiter;
+	source->parent.next = fd_source_next;
+
+	return 0;
+}
+
+void adopt_fd_source_dispose(adopt_fd_source *source)
+{
+	if (!source)
+		return;
+
+	free(source->buf[0]);
+	source->buf[0] = source->buf[1] = NULL;
+}
+
+#define SORT_BUFFER_LEN 128
+
+/* Tests substitute the allocation, to exercise the fallback sort */
+#ifdef ADOPT_SORT_ALLOC
+extern void *ADOPT_SORT_ALLOC(size_t len);
+#else
+# define ADOPT_SORT_ALLOC malloc
+#endif
+
+/*
+ * Rotate the `bare_len` arguments at the start of the array behind
+ * the `opt_len` arguments that follow them, in place.
+ */
+static void args_rotate(char **args, size_t bare_len, size_t opt_len)
+{
+	char *tmp, **lo, **hi;
+	size_t i, len = bare_len + opt_len;
+
+	for (i = 0; i < 3; i++) {
+		lo = (i == 1) ? &args[bare_len] : args;
+		hi = (i == 0) ? &args[bare_len - 1] : &args[len - 1];
+
+		for (; lo < hi; lo++, hi--) {
+			tmp = *lo;
+			*lo = *hi;
+			*hi = tmp;
+		}
+	}
+}
+
+/*
+ * Options that take words point into the arguments; once the options
+ * have been sorted ahead of the bare arguments, point them at where
+ * their words were moved.
+ */
+static void sort_words_update(adopt_parser *parser, size_t opts_len)
+{
+	const adopt_spec *spec;
+	adopt_words *words;
+	size_t idx, len;
+	int needs_value;
+
+	for (idx = parser->idx; idx < parser->idx + opts_len; idx += len) {
+		sort_classify(&len, parser, idx);
+
+		if (len < 2 ||
+		    (spec = spec_for_sort(&needs_value, parser, parser->args[idx],
+				parser_tag(parser, idx), NULL)) == NULL ||
+		    !spec_takes_words(spec) ||
+		    (words = spec_target(parser, spec)) == NULL)
+			continue;
+
+		words->args = &parser->args[idx + 1];
+	}
+}
+
+/*
+ * Some parsers allow for handling arguments like "file1 --help file2";
+ * this is done by re-sorting the arguments in-place; emulate that.
+ *
+ * The options following the first bare argument are parsed where they
+ * appear (see `gnu_next_option`); once they're exhausted, this sorts
+ * the arguments between the first bare argument and the end of the
+ * options.  This is a stable partition: options (and their values)
+ * move to the front, bare arguments follow in their original order.
+ * Options are gathered into a buffer while bare arguments are
+ * compacted behind them, then each is moved into place with a single
+ * copy.  The buffer holds every option when it can be allocated;
+ * otherwise, a bounded buffer is used over several linear passes.
+ * Returns the number of option arguments moved to the front.
+ */
+static size_t sort_gnu_style(adopt_parser *parser)
+{
+	char *stack_buf[SORT_BUFFER_LEN], **buf = stack_buf;
+	adopt_tag *tags = parser->tags;
+	const adopt_spec **matches = parser->matches;
+	size_t buf_len = SORT_BUFFER_LEN;
+	size_t i, len, lo = parser->idx, stop = parser->bare_stop;
+	size_t opts_len = 0, bare_len, opt_len;
+
+	for (i = lo; i < stop; i += len) {
+		if (sort_classify(&len, parser, i) != SORT_BARE)
+			opts_len += len;
+	}
+
+	if (opts_len > SORT_BUFFER_LEN &&
+	    (buf = ADOPT_SORT_ALLOC(sizeof(char *) * opts_len)) != NULL)
+		buf_len = opts_len;
 	else
-		opt->status = ADOPT_STATUS_OK;
+		buf = stack_buf;
 
-	consume_choices(opt->spec, parser);
+	while (lo < parser->idx + opts_len) {
+		bare_len = opt_len = 0;
+
+		/*
+		 * Without room for all the options, this takes several
+		 * passes; the tags (and matches) aren't moved with the
+		 * arguments, so later passes classify the arguments from
+		 * their text.
+		 */
+		if (lo != parser->idx) {
+			parser->tags = NULL;
+			parser->matches = NULL;
+		}
+
+		for (i = lo; i < stop; i += len) {
+			if (sort_classify(&len, parser, i) == SORT_BARE) {
+				parser->args[lo + bare_len++] = parser->args[i];
+				continue;
+			}
+
+			if (opt_len + len > buf_len)
+				break;
+
+			memcpy(&buf[opt_len], &parser->args[i], sizeof(char *) * len);
+			opt_len += len;
+		}
+
+		/*
+		 * An option with more words than the buffer holds is
+		 * rotated into place; everything before it is bare.
+		 */
+		if (!opt_len && i < stop) {
+			args_rotate(&parser->args[lo], i - lo, len);
+			lo += len;
+			continue;
+		}
+
+		memmove(&parser->args[lo + opt_len], &parser->args[lo],
+			sizeof(char *) * bare_len);
+		memcpy(&parser->args[lo], buf, sizeof(char *) * opt_len);
+
+		lo += opt_len;
+	}
+
+	if (buf != stack_buf)
+		free(buf);
+
+	parser->tags = tags;
+	parser->matches = matches;
+
+	/* The tags were classified in the original order */
+	if (parser->tags)
+		classify_args(&parser->tags[parser->idx],
+			&parser->args[parser->idx], stop - parser->idx);
+
+	if (parser->sort_words)
+		sort_words_update(parser, opts_len);
+
+	return opts_len;
+}
+
+/*
+ * In GNU mode, options may follow the first bare argument.  Rather
+ * than sorting all the arguments up-front, options are found and
+ * parsed where they appear, only as the caller asks for them: position
+ * the parser on the next option following the bare arguments.  Once
+ * the options are exhausted (at a literal "--" or the end of the
+ * arguments), return to the first bare argument; when reordering,
+ * sort the options that were parsed ahead of the bare arguments.
+ */
+static void gnu_next_option(adopt_parser *parser)
+{
+	size_t idx, len;
+	sort_kind_t kind;
+
+	for (idx = parser->idx; idx < parser->args_len; idx += len) {
+		if ((kind = sort_classify(&len, parser, idx)) == SORT_LITERAL)
+			break;
+
+		if (kind != SORT_BARE) {
+			parser->idx = idx;
+			return;
+		}
+	}
+
+	parser->in_gnu_opts = 0;
+	parser->bare_stop = idx;
+	parser->idx = parser->bare_idx;
+
+	if ((parser->flags & ADOPT_PARSE_PRESERVE_ARGS))
+		parser->in_gnu_args = 1;
+	else
+		parser->idx += sort_gnu_style(parser);
+}
+
+/*
+ * When not reordering, position the parser on the next bare argument,
+ * skipping over the options that were already parsed.
+ */
+static void gnu_next_arg(adopt_parser *parser)
+{
+	size_t len;
+
+	while (parser->idx < parser->bare_stop) {
+		if (sort_classify(&len, parser, parser->idx) == SORT_BARE)
+			return;
+
+		parser->idx += len;
+	}
+
+	parser->in_gnu_args = 0;
+}
+
+adopt_status_t adopt_parser_next(adopt_opt *opt, adopt_parser *parser)
+{
+	const char *arg;
+	size_t len;
+	adopt_tag_t kind;
+
+	assert(opt && parser);
+
+	memset(opt, 0x0, sizeof(adopt_opt));
+
+	/* Response files that couldn't be expanded fail the parser (once) */
+	if ((parser->flags & ADOPT_PARSE_RESPONSE_FILES) &&
+	    parser->response_status != ADOPT_STATUS_OK) {
+		opt->arg = parser->response ? parser->response->error_arg : NULL;
+		opt->status = parser->response_status;
+
+		parser->response_status = ADOPT_STATUS_OK;
+		parser->idx = parser->args_len;
+		return opt->status;
+	}
+
+	/* Flags that the parser can't honour fail it (once) */
+	if (parser->invalid_flags) {
+		parser->invalid_flags = 0;
+		parser->source = NULL;
+		parser->idx = parser->args_len;
+		return (opt->status = ADOPT_STATUS_UNSUPPORTED_FLAGS);
+	}
+
+	if (parser->source)
+		return source_next(opt, parser);
+
+	/*
+	 * We've reached the first "bare" argument.  In POSIX mode, all
+	 * remaining items on the command line are arguments.  In GNU
+	 * mode, there may be long or short options after this; parse
+	 * those first, then return for the bare arguments.
+	 */
+	if (parser->needs_sort && !parser->in_short && !parser->in_literal &&
+	    parser->idx < parser->args_len &&
+	    (parser->tags ?
+	     ADOPT_TAG_KIND(parser->tags[parser->idx]) == ADOPT_TAG_BARE :
+	     parser->args[parser->idx][0] != '-')) {
+		parser->needs_sort = 0;
+		parser->in_gnu_opts = 1;
+		parser->bare_idx = parser->idx;
+	}
+
+	if (parser->in_gnu_opts && !parser->in_short)
+		gnu_next_option(parser);
+
+	if (parser->in_gnu_args && !parser->in_short)
+		gnu_next_arg(parser);
+
+	if (parser->idx >= parser->args_len) {
+		opt->args_len = parser->in_args;
+		args_iter_init(&opt->args, parser);
+		return ADOPT_STATUS_DONE;
+	}
+
+	/*
+	 * Following a literal, everything is an argument; dispatch it
+	 * directly, without classifying it or sorting GNU-style.
+	 */
+	if (parser->in_literal)
+		return parse_arg(opt, parser);
+
+	/* Continue a cluster of short options, like "-fbcd" */
+	if (parser->in_short)
+		return parse_short(opt, parser);
+
+	if (parser->tags) {
+		kind = ADOPT_TAG_KIND(parser->tags[parser->idx]);
+	} else {
+		arg = parser_arg(&len, parser, parser->idx);
+		kind = arg_kind(arg, len);
+	}
+
+	/* Handle options in long form, those beginning with "--" */
+	if (kind == ADOPT_TAG_LONG || kind == ADOPT_TAG_LITERAL)
+		return parse_long(opt, parser);
+
+	/* Handle options in short form, those beginning with "-" */
+	else if (kind == ADOPT_TAG_SHORT)
+		return parse_short(opt, parser);
+
+	return parse_arg(opt, parser);
+}
+
+/*
+ * The number of specs from `spec` to the end of its choice group,
+ * including `spec` itself.
+ */
+INLINE(size_t) choice_remaining(
+	const adopt_index *index,
+	const adopt_spec specs[],
+	const adopt_spec *spec)
+{
+	const index_choice *choice;
+	size_t len = 1;
+
+	if (index) {
+		choice = &index->choices[spec - specs];
+		return (choice->start + choice->len) - (size_t)(spec - specs);
+	}
+
+	while (spec[len].type && (spec[len].usage & ADOPT_USAGE_CHOICE))
+		len++;
+
+	return len;
+}
+
+static adopt_status_t validate_required(
+	adopt_opt *opt,
+	const adopt_index *index,
+	const adopt_spec specs[],
+	const unsigned char *given_specs)
+{
+	const adopt_spec *spec;
+	size_t len, i;
+	int given;
+
+	/*
+	 * Iterate over the possible specs to identify requirements and
+	 * ensure that those have been given on the command-line.
+	 * Note that we can have required *choices*, where one in a
+	 * list of choices must be specified; those are checked as a
+	 * whole, and then skipped.
+	 */
+	for (spec = specs; spec->type; spec += len) {
+		if (!(spec->usage & ADOPT_USAGE_REQUIRED)) {
+			len = 1;
+			continue;
+		}
+
+		len = choice_remaining(index, specs, spec);
+
+		for (i = 0, given = 0; i < len && !given; i++)
+			given = given_test(given_specs, specs, spec + i);
+
+		if (!given) {
+			opt->spec = spec;
+			opt->status = ADOPT_STATUS_MISSING_ARGUMENT;
+			break;
+		}
+	}
 
-done:
 	return opt->status;
 }
 
-static adopt_status_t parse_short(adopt_opt *opt, adopt_parser *parser)
+/*
+ * Parses all the arguments, marking each spec that was given in the
+ * `given` bitset (which must be zeroed), then validates requirements.
+ */
+static adopt_status_t parse_all(
+	adopt_opt *opt,
+	adopt_parser *parser,
+	unsigned char *given)
+{
+	for (;;) {
+		parse_short_flags(given, parser);
+
+		if (!adopt_parser_next(opt, parser))
+			break;
+
+		if (opt->status != ADOPT_STATUS_OK &&
+		    opt->status != ADOPT_STATUS_DONE)
+			return opt->status;
+
+		if ((opt->spec->usage & ADOPT_USAGE_STOP_PARSING))
+			return (opt->status = ADOPT_STATUS_DONE);
+
+		given_set(given, parser->specs, opt->spec);
+	}
+
+	return validate_required(opt, parser->index, parser->specs, given);
+}
+
+/*
+ * Track the given specs in a bitset indexed by spec position; its
+ * size depends only on the number of specs, not arguments.  Small
+ * bitsets use the caller's buffer.
+ */
+INLINE(unsigned char *) given_alloc(
+	unsigned char *buf,
+	size_t *len,
+	size_t specs_len)
+{
+	*len = (specs_len + CHAR_BIT - 1) / CHAR_BIT;
+
+	if (*len <= GIVEN_BUFFER_LEN)
+		return buf;
+
+	return malloc(*len);
+}
+
+static adopt_status_t parse_tracked(
+	adopt_opt *opt,
+	adopt_parser *parser,
+	size_t specs_len)
+{
+	unsigned char given_buf[GIVEN_BUFFER_LEN], *given;
+	size_t given_len;
+
+	if ((given = given_alloc(given_buf, &given_len, specs_len)) == NULL) {
+		memset(opt, 0, sizeof(adopt_opt));
+		return (opt->status = ADOPT_STATUS_OUT_OF_MEMORY);
+	}
+
+	memset(given, 0, given_len);
+	parse_all(opt, parser, given);
+
+	if (given != given_buf)
+		free(given);
+
+	return opt->status;
+}
+
+/*
+ * Values may point into response files, which would need to outlive
+ * a parser that's disposed of before returning; callers expand those
+ * themselves.
+ */
+#define ONESHOT_UNSUPPORTED_FLAGS ADOPT_PARSE_RESPONSE_FILES
+
+adopt_status_t adopt_parse(
+	adopt_opt *opt,
+	const adopt_spec specs[],
+	char **args,
+	size_t args_len,
+	unsigned int flags)
+{
+	adopt_parser parser;
+	const adopt_spec *spec;
+
+	adopt_parser_init(&parser, specs, args, args_len,
+		flags & ~ONESHOT_UNSUPPORTED_FLAGS);
+	parser.invalid_flags = !!(flags & ONESHOT_UNSUPPORTED_FLAGS);
+
+	for (spec = specs; spec->type; ++spec)
+		;
+
+	return parse_tracked(opt, &parser, (size_t)(spec - specs));
+}
+
+adopt_status_t adopt_parse_config(
+	adopt_opt *opt,
+	const adopt_spec specs[],
+	void *config,
+	const void *defaults,
+	size_t config_size,
+	char **args,
+	size_t args_len,
+	unsigned int flags)
+{
+	adopt_parser parser;
+	const adopt_spec *spec;
+
+	assert(config);
+
+	/* Reset the whole structure at once, instead of member by member */
+	if (defaults)
+		memcpy(config, defaults, config_size);
+
+	adopt_parser_init(&parser, specs, args, args_len,
+		flags & ~ONESHOT_UNSUPPORTED_FLAGS);
+	parser.invalid_flags = !!(flags & ONESHOT_UNSUPPORTED_FLAGS);
+	parser.config = config;
+
+	for (spec = specs; spec->type; ++spec)
+		;
+
+	return parse_tracked(opt, &parser, (size_t)(spec - specs));
+}
+
+adopt_status_t adopt_parse_index(
+	adopt_opt *opt,
+	const adopt_index *index,
+	adopt_value *results,
+	char **args,
+	size_t args_len,
+	unsigned int flags)
 {
-	const adopt_spec *spec;
-	char *arg = parser->args[parser->idx++];
-	const char *value;
+	adopt_parser parser;
 
-	opt->arg = arg;
+	adopt_parser_init_results(&parser, index, results, args, args_len,
+		flags & ~ONESHOT_UNSUPPORTED_FLAGS);
+	parser.invalid_flags = !!(flags & ONESHOT_UNSUPPORTED_FLAGS);
 
-	if ((spec = spec_for_short(&value, parser, &arg[1 + parser->in_short])) == NULL) {
-		opt->spec = NULL;
-		opt->status = ADOPT_STATUS_UNKNOWN_OPTION;
-		goto done;
-	}
+	return parse_tracked(opt, &parser, index->specs_len);
+}
 
-	opt->spec = spec;
+typedef struct {
+	const adopt_index *index;
+	adopt_batch *batch;
+	size_t batch_len;
+	unsigned int flags;
+	size_t failed;
+} batch_worker;
 
-	if (spec->type == ADOPT_TYPE_BOOL && spec->value)
-		*((int *)spec->value) = 1;
+/*
+ * Parse a contiguous run of command lines; the bitset of given specs
+ * is allocated once and reused for each of them.
+ */
+static void parse_batch(void *data)
+{
+	batch_worker *worker = (batch_worker *)data;
+	adopt_parser parser;
+	adopt_batch *item;
+	unsigned char given_buf[GIVEN_BUFFER_LEN], *given;
+	size_t given_len, i;
 
-	else if (spec->type == ADOPT_TYPE_ACCUMULATOR && spec->value)
-		*((int *)spec->value) += spec->switch_value ? spec->switch_value : 1;
+	given = given_alloc(given_buf, &given_len, worker->index->specs_len);
 
-	else if (spec->type == ADOPT_TYPE_SWITCH && spec->value)
-		*((int *)spec->value) = spec->switch_value;
+	for (i = 0; i < worker->batch_len; i++) {
+		item = &worker->batch[i];
 
-	/* Parse values as "-ifoo" or "-i foo" */
-	else if (spec->type == ADOPT_TYPE_VALUE) {
-		if (value)
-			opt->value = (char *)value;
-		else if ((parser->idx + 1) <= parser->args_len)
-			opt->value = parser->args[parser->idx++];
+		if (!given) {
+			memset(&item->opt, 0, sizeof(adopt_opt));
+			item->opt.status = ADOPT_STATUS_OUT_OF_MEMORY;
+		} else {
+			memset(given, 0, given_len);
 
-		if (spec->value)
-			*((char **)spec->value) = opt->value;
-	}
+			adopt_parser_init_results(&parser, worker->index,
+				item->results, item->args, item->args_len,
+				worker->flags);
+			parser.config = item->config;
+			parse_all(&item->opt, &parser, given);
+		}
 
-	/*
-	 * Handle compressed short arguments, like "-fbcd"; see if there's
-	 * another character after the one we processed.  If not, advance
-	 * the parser index.
-	 */
-	if (spec->type != ADOPT_TYPE_VALUE && arg[2 + parser->in_short] != '\0') {
-		parser->in_short++;
-		parser->idx--;
-	} else {
-		parser->in_short = 0;
+		if (item->opt.status != ADOPT_STATUS_DONE)
+			worker->failed++;
 	}
 
-	/* Required argument was not provided */
-	if (spec->type == ADOPT_TYPE_VALUE && !opt->value)
-		opt->status = ADOPT_STATUS_MISSING_VALUE;
-	else
-		opt->status = ADOPT_STATUS_OK;
-
-	consume_choices(opt->spec, parser);
-
-done:
-	return opt->status;
+	if (given != given_buf)
+		free(given);
 }
 
-static adopt_status_t parse_arg(adopt_opt *opt, adopt_parser *parser)
-{
-	const adopt_spec *spec = spec_for_arg(parser);
+#ifdef ADOPT_THREADS
 
-	opt->spec = spec;
-	opt->arg = parser->args[parser->idx];
+#define MAX_THREADS 64
 
-	if (!spec) {
-		parser->idx++;
-		opt->status = ADOPT_STATUS_UNKNOWN_OPTION;
-	} else if (spec->type == ADOPT_TYPE_ARGS) {
-		if (spec->value)
-			*((char ***)spec->value) = &parser->args[parser->idx];
+typedef struct {
+	void (*run)(void *data);
+	void *data;
+} worker_task;
 
-		/*
-		 * We have started a list of arguments; the remainder of
-		 * given arguments need not be examined.
-		 */
-		parser->in_args = (parser->args_len - parser->idx);
-		parser->idx = parser->args_len;
-		opt->args_len = parser->in_args;
-		opt->status = ADOPT_STATUS_OK;
-	} else {
-		if (spec->value)
-			*((char **)spec->value) = parser->args[parser->idx];
+#ifdef _WIN32
+typedef HANDLE worker_thread;
 
-		parser->idx++;
-		opt->status = ADOPT_STATUS_OK;
-	}
+static DWORD WINAPI worker_thread_main(LPVOID data)
+{
+	worker_task *task = (worker_task *)data;
+	task->run(task->data);
+	return 0;
+}
 
-	return opt->status;
+INLINE(int) worker_thread_start(worker_thread *thread, worker_task *task)
+{
+	*thread = CreateThread(NULL, 0, worker_thread_main, task, 0, NULL);
+	return (*thread == NULL) ? -1 : 0;
 }
 
-static int support_gnu_style(unsigned int flags)
+INLINE(void) worker_thread_join(worker_thread thread)
 {
-	if ((flags & ADOPT_PARSE_FORCE_GNU) != 0)
-		return 1;
+	WaitForSingleObject(thread, INFINITE);
+	CloseHandle(thread);
+}
+#else
+typedef pthread_t worker_thread;
 
-	if ((flags & ADOPT_PARSE_GNU) == 0)
-		return 0;
+static void *worker_thread_main(void *data)
+{
+	worker_task *task = (worker_task *)data;
+	task->run(task->data);
+	return NULL;
+}
 
-	/* TODO: Windows */
-#if defined(_WIN32) && defined(UNICODE)
-	if (_wgetenv(L"POSIXLY_CORRECT") != NULL)
-		return 0;
-#else
-	if (getenv("POSIXLY_CORRECT") != NULL)
-		return 0;
-#endif
+INLINE(int) worker_thread_start(worker_thread *thread, worker_task *task)
+{
+	return pthread_create(thread, NULL, worker_thread_main, task) ? -1 : 0;
+}
 
-	return 1;
+INLINE(void) worker_thread_join(worker_thread thread)
+{
+	pthread_join(thread, NULL);
 }
+#endif
 
-void adopt_parser_init(
-	adopt_parser *parser,
-	const adopt_spec specs[],
-	char **args,
-	size_t args_len,
-	unsigned int flags)
+/*
+ * Run each task on its own thread, and wait for them all to finish;
+ * the calling thread runs the first task itself, and any task whose
+ * thread could not be started.
+ */
+static void run_tasks(worker_task *tasks, size_t tasks_len)
 {
-	assert(parser);
+	worker_thread handles[MAX_THREADS];
+	int started[MAX_THREADS];
+	size_t i;
 
-	memset(parser, 0x0, sizeof(adopt_parser));
+	assert(tasks_len <= MAX_THREADS);
 
-	parser->specs = specs;
-	parser->args = args;
-	parser->args_len = args_len;
-	parser->flags = flags;
+	for (i = 1; i < tasks_len; i++) {
+		if (!(started[i] = (worker_thread_start(&handles[i], &tasks[i]) == 0)))
+			tasks[i].run(tasks[i].data);
+	}
+
+	tasks[0].run(tasks[0].data);
 
-	parser->needs_sort = support_gnu_style(flags);
+	for (i = 1; i < tasks_len; i++) {
+		if (started[i])
+			worker_thread_join(handles[i]);
+	}
 }
 
-INLINE(const adopt_spec *) spec_for_sort(
-	int *needs_value,
-	const adopt_parser *parser,
-	const char *arg)
+/*
+ * Split the batch into one contiguous run per worker.  Workers share
+ * nothing but the (immutable) index, so no locking is needed.
+ */
+static size_t parse_batch_threaded(
+	const adopt_index *index,
+	adopt_batch *batch,
+	size_t batch_len,
+	unsigned int flags,
+	size_t threads)
 {
-	int is_negated, has_value = 0;
-	const char *value;
-	const adopt_spec *spec = NULL;
-	size_t idx = 0;
-
-	*needs_value = 0;
+	batch_worker workers[MAX_THREADS];
+	worker_task tasks[MAX_THREADS];
+	size_t start, failed = 0, i;
 
-	if (strncmp(arg, "--", 2) == 0) {
-		spec = spec_for_long(&is_negated, &has_value, &value, parser, &arg[2]);
-		*needs_value = !has_value;
-	}
+	if (threads > MAX_THREADS)
+		threads = MAX_THREADS;
 
-	else if (strncmp(arg, "-", 1) == 0) {
-		spec = spec_for_short(&value, parser, &arg[1]);
+	for (i = 0, start = 0; i < threads; i++) {
+		workers[i].index = index;
+		workers[i].batch = &batch[start];
+		workers[i].batch_len = (batch_len * (i + 1)) / threads - start;
+		workers[i].flags = flags;
+		workers[i].failed = 0;
 
-		/*
-		 * Advance through compressed short arguments to see if
-		 * the last one has a value, eg "-xvffilename".
-		 */
-		while (spec && !value && arg[1 + ++idx] != '\0')
-			spec = spec_for_short(&value, parser, &arg[1 + idx]);
+		tasks[i].run = parse_batch;
+		tasks[i].data = &workers[i];
 
-		*needs_value = (value == NULL);
+		start += workers[i].batch_len;
 	}
 
-	return spec;
+	run_tasks(tasks, threads);
+
+	for (i = 0; i < threads; i++)
+		failed += workers[i].failed;
+
+	return failed;
 }
 
-/*
- * Some parsers allow for handling arguments like "file1 --help file2";
- * this is done by re-sorting the arguments in-place; emulate that.
- */
-static int sort_gnu_style(adopt_parser *parser)
+#endif
+
+size_t adopt_parse_batch(
+	const adopt_index *index,
+	adopt_batch *batch,
+	size_t batch_len,
+	unsigned int flags,
+	unsigned int threads)
 {
-	size_t i, j, insert_idx = parser->idx, offset;
-	const adopt_spec *spec;
-	char *option, *value;
-	int needs_value, changed = 0;
+	batch_worker worker;
+	size_t i;
 
-	parser->needs_sort = 0;
+	assert(index && (batch || !batch_len));
 
-	for (i = parser->idx; i < parser->args_len; i++) {
-		spec = spec_for_sort(&needs_value, parser, parser->args[i]);
+	if ((flags & ONESHOT_UNSUPPORTED_FLAGS)) {
+		for (i = 0; i < batch_len; i++) {
+			memset(&batch[i].opt, 0, sizeof(adopt_opt));
+			batch[i].opt.status = ADOPT_STATUS_UNSUPPORTED_FLAGS;
+		}
 
-		/* Not a "-" or "--" prefixed option.  No change. */
-		if (!spec)
-			continue;
+		return batch_len;
+	}
 
-		/* A "--" alone means remaining args are literal. */
-		if (spec->type == ADOPT_TYPE_LITERAL)
-			break;
+#ifdef ADOPT_THREADS
+	if (threads > batch_len)
+		threads = (unsigned int)batch_len;
 
-		option = parser->args[i];
+	if (threads > 1)
+		return parse_batch_threaded(index, batch, batch_len, flags, threads);
+#else
+	(void)threads;
+#endif
 
-		/*
-		 * If the argument is a value type and doesn't already
-		 * have a value (eg "--foo=bar" or "-fbar") then we need
-		 * to copy the next argument as its value.
-		 */
-		if (spec->type == ADOPT_TYPE_VALUE && needs_value) {
-			/*
-			 * A required value is not provided; set parser
-			 * index to this value so that we fail on it.
-			 */
-			if (i + 1 >= parser->args_len) {
-				parser->idx = i;
-				return 1;
-			}
+	worker.index = index;
+	worker.batch = batch;
+	worker.batch_len = batch_len;
+	worker.flags = flags;
+	worker.failed = 0;
+
+	parse_batch(&worker);
+
+	return worker.failed;
+}
+
+#ifdef ADOPT_THREADS
+
+/* The fewest arguments worth matching on a thread of their own */
+#define PARALLEL_MIN_ARGS 8192
+
+typedef struct {
+	const adopt_parser *parser;
+	size_t start;
+	size_t end;
+} match_worker;
 
-			value = parser->args[i + 1];
-			offset = 1;
+/*
+ * Classify a contiguous run of arguments and match each option to its
+ * spec, and (when sorting GNU-style) the arguments that it spans.
+ * Only the tags and matches within the run are written, so runs can
+ * be matched concurrently.
+ */
+static void match_args(void *data)
+{
+	match_worker *worker = (match_worker *)data;
+	const adopt_parser *parser = worker->parser;
+	const adopt_spec *spec;
+	const char *arg, *value;
+	adopt_tag tag;
+	size_t i, len;
+	int is_negated, has_value;
+
+	classify_args(&parser->tags[worker->start],
+		&parser->args[worker->start], worker->end - worker->start);
+
+	for (i = worker->start; i < worker->end; i++) {
+		arg = parser->args[i];
+		tag = parser->tags[i];
+
+		if (ADOPT_TAG_KIND(tag) == ADOPT_TAG_SHORT) {
+			spec = spec_for_short(&value, parser, &arg[1], ARG_TERMINATED, NULL);
+		} else if (ADOPT_TAG_KIND(tag) != ADOPT_TAG_BARE && tag_has_name(tag)) {
+			is_negated = 0;
+			spec = spec_for_long(&is_negated, &has_value, &value,
+				parser, &arg[2], ARG_TERMINATED, tag, NULL);
+
+			if (is_negated)
+				tag |= TAG_NEGATED;
 		} else {
-			value = NULL;
-			offset = 0;
+			continue;
 		}
 
-		/* Caller error if args[0] is an option. */
-		if (i == 0)
-			return 0;
+		parser->matches[i] = spec;
+		parser->tags[i] = tag | TAG_MATCHED;
 
-		/* Shift args up one (or two) and insert the option */
-		for (j = i; j > insert_idx; j--)
-			parser->args[j + offset] = parser->args[j - 1];
+		if (parser->needs_sort)
+			sort_classify(&len, parser, i);
+	}
+}
 
-		parser->args[insert_idx] = option;
+static void match_args_threaded(adopt_parser *parser, size_t threads)
+{
+	match_worker workers[MAX_THREADS];
+	worker_task tasks[MAX_THREADS];
+	size_t start, i;
 
-		if (value)
-			parser->args[insert_idx + 1] = value;
+	for (i = 0, start = 0; i < threads; i++) {
+		workers[i].parser = parser;
+		workers[i].start = start;
+		workers[i].end = (parser->args_len * (i + 1)) / threads;
 
-		insert_idx += (1 + offset);
-		i += offset;
+		tasks[i].run = match_args;
+		tasks[i].data = &workers[i];
 
-		changed = 1;
+		start = workers[i].end;
 	}
 
-	return changed;
+	run_tasks(tasks, threads);
 }
 
-adopt_status_t adopt_parser_next(adopt_opt *opt, adopt_parser *parser)
+#endif
+
+adopt_status_t adopt_parse_parallel(
+	adopt_opt *opt,
+	const adopt_index *index,
+	adopt_value *results,
+	char **args,
+	size_t args_len,
+	unsigned int flags,
+	unsigned int threads)
 {
-	assert(opt && parser);
+	adopt_parser parser;
+#ifdef ADOPT_THREADS
+	adopt_tag *tags;
+	const adopt_spec **matches;
+#endif
 
-	memset(opt, 0x0, sizeof(adopt_opt));
+	assert(opt && index && (args || !args_len));
 
-	if (parser->idx >= parser->args_len) {
-		opt->args_len = parser->in_args;
-		return ADOPT_STATUS_DONE;
-	}
+	adopt_parser_init_results(&parser, index, results, args, args_len,
+		flags & ~ONESHOT_UNSUPPORTED_FLAGS);
+	parser.invalid_flags = !!(flags & ONESHOT_UNSUPPORTED_FLAGS);
 
-	/* Handle options in long form, those beginning with "--" */
-	if (strncmp(parser->args[parser->idx], "--", 2) == 0 &&
-	    !parser->in_short &&
-	    !parser->in_literal)
-		return parse_long(opt, parser);
+#ifdef ADOPT_THREADS
+	if (threads > MAX_THREADS)
+		threads = MAX_THREADS;
 
-	/* Handle options in short form, those beginning with "-" */
-	else if (parser->in_short ||
-	         (strncmp(parser->args[parser->idx], "-", 1) == 0 &&
-		  !parser->in_literal))
-		return parse_short(opt, parser);
+	if (threads > args_len / PARALLEL_MIN_ARGS)
+		threads = (unsigned int)(args_len / PARALLEL_MIN_ARGS);
 
 	/*
-	 * We've reached the first "bare" argument.  In POSIX mode, all
-	 * remaining items on the command line are arguments.  In GNU
-	 * mode, there may be long or short options after this.  Sort any
-	 * options up to this position then re-parse the current position.
+	 * Match the arguments to their specs concurrently, then parse
+	 * them in order, so that later options override earlier ones
+	 * and positional arguments are numbered exactly as they would
+	 * be when parsed serially.
 	 */
-	if (parser->needs_sort && sort_gnu_style(parser))
-		return adopt_parser_next(opt, parser);
+	if (threads > 1) {
+		tags = malloc(sizeof(adopt_tag) * args_len);
+		matches = malloc(sizeof(adopt_spec *) * args_len);
 
-	return parse_arg(opt, parser);
-}
+		if (!tags || !matches) {
+			free(tags);
+			free(matches);
 
-INLINE(int) spec_included(const adopt_spec **specs, const adopt_spec *spec)
-{
-	const adopt_spec **i;
+			memset(opt, 0, sizeof(adopt_opt));
+			return (opt->status = ADOPT_STATUS_OUT_OF_MEMORY);
+		}
 
-	for (i = specs; *i; ++i) {
-		if (spec == *i)
-			return 1;
+		parser.tags = tags;
+		parser.matches = matches;
+
+		match_args_threaded(&parser, threads);
+		parse_tracked(opt, &parser, index->specs_len);
+
+		free(tags);
+		free(matches);
+		return opt->status;
 	}
+#else
+	(void)threads;
+#endif
 
-	return 0;
+	return parse_tracked(opt, &parser, index->specs_len);
 }
 
-static adopt_status_t validate_required(
-	adopt_opt *opt,
-	const adopt_spec specs[],
-	const adopt_spec **given_specs)
+/*
+ * Split a string into arguments like a POSIX shell: arguments are
+ * separated by blanks; a backslash escapes the following character (or
+ * joins lines, when followed by a newline); single quotes preserve
+ * everything until the closing quote; and in double quotes, backslash
+ * only escapes '$', '`', '"', '\' and newline.  Expansions are not
+ * performed.  The arguments are unquoted in place, by moving each
+ * argument's remaining characters down, and terminated with a NUL.
+ */
+int adopt_tokenize(
+	char **args,
+	size_t *args_len,
+	size_t args_size,
+	char *str)
 {
-	const adopt_spec *spec, *required;
-	int given;
+	char *in = str, *out, quote;
 
-	/*
-	 * Iterate over the possible specs to identify requirements and
-	 * ensure that those have been given on the command-line.
-	 * Note that we can have required *choices*, where one in a
-	 * list of choices must be specified.
-	 */
-	for (spec = specs, required = NULL, given = 0; spec->type; ++spec) {
-		if (!required && (spec->usage & ADOPT_USAGE_REQUIRED)) {
-			required = spec;
-			given = 0;
-		} else if (!required) {
-			continue;
-		}
+	assert(args_len && str && (args || !args_size));
 
-		if (!given)
-			given = spec_included(given_specs, spec);
+	*args_len = 0;
 
-		/*
-		 * Validate the requirement unless we're in a required
-		 * choice.  In that case, keep the required state and
-		 * validate at the end of the choice list.
-		 */
-		if (!spec_is_choice(spec)) {
-			if (!given) {
-				opt->spec = required;
-				opt->status = ADOPT_STATUS_MISSING_ARGUMENT;
+	for (;;) {
+		/* A joined line between arguments doesn't begin one */
+		while (*in == ' ' || *in == '\t' || *in == '\n' ||
+		       (*in == '\\' && in[1] == '\n'))
+			in += (*in == '\\') ? 2 : 1;
+
+		if (!*in)
+			return 0;
+
+		if (*args_len == args_size)
+			return -1;
+
+		args[(*args_len)++] = out = in;
+
+		for (quote = 0; *in; ) {
+			if (quote == '\'' && *in == '\'') {
+				quote = 0;
+				in++;
+			} else if (quote == '\'') {
+				*out++ = *in++;
+			} else if (*in == '\\') {
+				if (!in[1])
+					return -1;
+
+				if (in[1] == '\n') {
+					in += 2;
+					continue;
+				}
+
+				if (!quote || in[1] == '$' || in[1] == '`' ||
+				    in[1] == '"' || in[1] == '\\')
+					in++;
+
+				*out++ = *in++;
+			} else if (quote == '"' && *in == '"') {
+				quote = 0;
+				in++;
+			} else if (quote == '"') {
+				*out++ = *in++;
+			} else if (*in == '\'' || *in == '"') {
+				quote = *in++;
+			} else if (*in == ' ' || *in == '\t' || *in == '\n') {
 				break;
+			} else {
+				*out++ = *in++;
 			}
-
-			required = NULL;
-			given = 0;
 		}
-	}
 
-	return opt->status;
+		if (quote)
+			return -1;
+
+		if (*in)
+			in++;
+
+		*out = '\0';
+	}
 }
 
-adopt_status_t adopt_parse(
+adopt_status_t adopt_parse_string(
 	adopt_opt *opt,
 	const adopt_spec specs[],
+	char *str,
 	char **args,
-	size_t args_len,
+	size_t args_size,
 	unsigned int flags)
 {
-	adopt_parser parser;
-	const adopt_spec **given_specs;
-	size_t given_idx = 0;
-
-	adopt_parser_init(&parser, specs, args, args_len, flags);
-
-	given_specs = alloca(sizeof(const adopt_spec *) * (args_len + 1));
-
-	while (adopt_parser_next(opt, &parser)) {
-		if (opt->status != ADOPT_STATUS_OK &&
-		    opt->status != ADOPT_STATUS_DONE)
-			return opt->status;
-
-		if ((opt->spec->usage & ADOPT_USAGE_STOP_PARSING))
-			return (opt->status = ADOPT_STATUS_DONE);
+	size_t args_len;
 
-		given_specs[given_idx++] = opt->spec;
+	if (adopt_tokenize(args, &args_len, args_size, str) < 0) {
+		memset(opt, 0x0, sizeof(adopt_opt));
+		return (opt->status = ADOPT_STATUS_INVALID_STRING);
 	}
 
-	given_specs[given_idx] = NULL;
-
-	return validate_required(opt, specs, given_specs);
+	return adopt_parse(opt, specs, args, args_len, flags);
 }
 
 int adopt_foreach(
@@ -589,7 +4276,9 @@ int adopt_foreach(
 	adopt_opt opt;
 	int ret;
 
-	adopt_parser_init(&parser, specs, args, args_len, flags);
+	adopt_parser_init(&parser, specs, args, args_len,
+		flags & ~ONESHOT_UNSUPPORTED_FLAGS);
+	parser.invalid_flags = !!(flags & ONESHOT_UNSUPPORTED_FLAGS);
 
 	while (adopt_parser_next(&opt, &parser)) {
 		if ((ret = callback(&opt, callback_data)) != 0)
@@ -620,7 +4309,9 @@ int adopt_status_fprint(
 	const char *command,
 	const adopt_opt *opt)
 {
-	const adopt_spec *choice;
+	const adopt_enum_value *value;
+	const adopt_spec *sub;
+	size_t len, i;
 	int error;
 
 	if (command && (error = fprintf(file, "%s: ", command)) < 0)
@@ -634,7 +4325,10 @@ int adopt_status_fprint(
 		error = fprintf(file, "no error\n");
 		break;
 	case ADOPT_STATUS_UNKNOWN_OPTION:
-		error = fprintf(file, "unknown option: %s\n", opt->arg);
+		if (opt->arg_len)
+			error = fprintf(file, "unknown option: %.*s\n", (int)opt->arg_len, opt->arg);
+		else
+			error = fprintf(file, "unknown option: %s\n", opt->arg);
 		break;
 	case ADOPT_STATUS_MISSING_VALUE:
 		if ((error = fprintf(file, "argument '")) < 0 ||
@@ -643,33 +4337,23 @@ int adopt_status_fprint(
 			break;
 		break;
 	case ADOPT_STATUS_MISSING_ARGUMENT:
-		if (spec_is_choice(opt->spec)) {
-			int is_choice = 1;
-
-			if (spec_is_choice((opt->spec)+1))
+		if ((len = choice_remaining(NULL, opt->spec, opt->spec)) > 1) {
+			if (len > 2)
 				error = fprintf(file, "one of");
 			else
 				error = fprintf(file, "either");
 
-			if (error < 0)
-				break;
-
-			for (choice = opt->spec; is_choice; ++choice) {
-				is_choice = spec_is_choice(choice);
-
-				if (!is_choice)
+			for (i = 0; error >= 0 && i < len; i++) {
+				if (i == len - 1)
 					error = fprintf(file, " or");
-				else if (choice != opt->spec)
+				else if (i > 0)
 					error = fprintf(file, ",");
 
 				if ((error < 0) ||
 				    (error = fprintf(file, " '")) < 0 ||
-				    (error = spec_name_fprint(file, choice)) < 0 ||
+				    (error = spec_name_fprint(file, opt->spec + i)) < 0 ||
 				    (error = fprintf(file, "'")) < 0)
 					break;
-
-				if (!spec_is_choice(choice))
-					break;
 			}
 
 			if ((error < 0) ||
@@ -682,6 +4366,59 @@ int adopt_status_fprint(
 				break;
 		}
 
+		break;
+	case ADOPT_STATUS_OUT_OF_MEMORY:
+		error = fprintf(file, "out of memory\n");
+		break;
+	case ADOPT_STATUS_SOURCE_ERROR:
+		error = fprintf(file, "could not read arguments\n");
+		break;
+	case ADOPT_STATUS_INVALID_STRING:
+		error = fprintf(file, "could not split command: unterminated quote or too many arguments\n");
+		break;
+	case ADOPT_STATUS_INVALID_RESPONSE_FILE:
+		error = fprintf(file, "could not read response file: %s\n", &opt->arg[1]);
+		break;
+	case ADOPT_STATUS_INVALID_VALUE:
+	case ADOPT_STATUS_VALUE_OUT_OF_RANGE:
+	case ADOPT_STATUS_UNKNOWN_UNIT:
+		if ((error = fprintf(file, "%s for argument '",
+				opt->status == ADOPT_STATUS_INVALID_VALUE ? "invalid value" :
+				opt->status == ADOPT_STATUS_UNKNOWN_UNIT ? "unknown unit" :
+				"value out of range")) < 0 ||
+		    (error = spec_name_fprint(file, opt->spec)) < 0)
+			break;
+
+		if (opt->value_len)
+			error = fprintf(file, "': %.*s\n", (int)opt->value_len, opt->value);
+		else
+			error = fprintf(file, "': %s\n", opt->value);
+		break;
+	case ADOPT_STATUS_UNKNOWN_VALUE:
+		if ((error = fprintf(file, "unknown value for argument '")) < 0 ||
+		    (error = spec_name_fprint(file, opt->spec)) < 0)
+			break;
+
+		if (opt->value_len)
+			error = fprintf(file, "': %.*s (expected one of:", (int)opt->value_len, opt->value);
+		else
+			error = fprintf(file, "': %s (expected one of:", opt->value);
+
+		for (value = spec_enum_values(opt->spec), i = 0;
+		     error >= 0 && value && value->name; value++, i++)
+			error = fprintf(file, "%s %s", i ? "," : "", value->name);
+
+		for (sub = spec_subopts(opt->spec), i = 0;
+		     error >= 0 && sub && sub->type; sub++) {
+			if (sub->name)
+				error = fprintf(file, "%s %s", i++ ? "," : "", sub->name);
+		}
+
+		if (error >= 0)
+			error = fprintf(file, ")\n");
+		break;
+	case ADOPT_STATUS_UNSUPPORTED_FLAGS:
+		error = fprintf(file, "unsupported flags for parsing\n");
 		break;
 	default:
 		error = fprintf(file, "Unknown status: %d\n", opt->status);
@@ -691,6 +4428,21 @@ int adopt_status_fprint(
 	return error;
 }
 
+static int words_usage_fprint(FILE *file, const adopt_spec *spec)
+{
+	int error;
+
+	if (spec->alias && !(spec->usage & ADOPT_USAGE_SHOW_LONG))
+		error = fprintf(file, "-%c <%s>...", spec->alias, spec->value_name);
+	else
+		error = fprintf(file, "--%s <%s>...", spec->name, spec->value_name);
+
+	if (error >= 0 && spec->type == ADOPT_TYPE_WORDS_UNTIL)
+		error = fprintf(file, " %s", words_terminator(spec));
+
+	return error;
+}
+
 int adopt_usage_fprint(
 	FILE *file,
 	const char *command,
@@ -728,18 +4480,20 @@ int adopt_usage_fprint(
 		if (error < 0)
 			goto done;
 
-		if (spec->type == ADOPT_TYPE_VALUE && spec->alias &&
+		if (spec_takes_value(spec) && spec->alias &&
 		    !(spec->usage & ADOPT_USAGE_VALUE_OPTIONAL) &&
 		    !(spec->usage & ADOPT_USAGE_SHOW_LONG))
 			error = fprintf(file, "-%c <%s>", spec->alias, spec->value_name);
-		else if (spec->type == ADOPT_TYPE_VALUE && spec->alias &&
+		else if (spec_takes_value(spec) && spec->alias &&
 		         !(spec->usage & ADOPT_USAGE_SHOW_LONG))
 			error = fprintf(file, "-%c [<%s>]", spec->alias, spec->value_name);
-		else if (spec->type == ADOPT_TYPE_VALUE &&
+		else if (spec_takes_value(spec) &&
 		         !(spec->usage & ADOPT_USAGE_VALUE_OPTIONAL))
 			error = fprintf(file, "--%s[=<%s>]", spec->name, spec->value_name);
-		else if (spec->type == ADOPT_TYPE_VALUE)
+		else if (spec_takes_value(spec))
 			error = fprintf(file, "--%s=<%s>", spec->name, spec->value_name);
+		else if (spec_takes_words(spec))
+			error = words_usage_fprint(file, spec);
 		else if (spec->type == ADOPT_TYPE_ARG)
 			error = fprintf(file, "<%s>", spec->value_name);
 		else if (spec->type == ADOPT_TYPE_ARGS)
@@ -10,6 +10,7 @@
 #define ADOPT_H
 
 #include <stdio.h>
+#include <stddef.h>
 #include <stdint.h>
 
 /**
@@ -77,6 +78,135 @@ typedef enum {
 	 * the value will be set to the first argument in the list.
 	 */
 	ADOPT_TYPE_ARGS,
+
+	/**
+	 * An option that takes a value, like `ADOPT_TYPE_VALUE`, and
+	 * that may be given any number of times, for example
+	 * `-I dir1 -I dir2`.  Every value is collected, in the order
+	 * given, into an `adopt_values`.
+	 */
+	ADOPT_TYPE_VALUES,
+
+	/**
+	 * Options that take a numeric value, like `ADOPT_TYPE_VALUE`,
+	 * that is converted as it's parsed and stored in the `value`
+	 * pointer: an `int32_t`, `uint32_t`, `int64_t`, `uint64_t` or
+	 * `double`, respectively.  Integers are given in decimal, with an
+	 * optional sign; doubles may have a fraction and an exponent (for
+	 * example, "-1.5e3").  A decimal point is always '.', regardless
+	 * of the locale.  A value that can't be converted fails with
+	 * `ADOPT_STATUS_INVALID_VALUE`, and one that doesn't fit in the
+	 * type fails with `ADOPT_STATUS_VALUE_OUT_OF_RANGE`.
+	 */
+	ADOPT_TYPE_INT32,
+	ADOPT_TYPE_UINT32,
+	ADOPT_TYPE_INT64,
+	ADOPT_TYPE_UINT64,
+	ADOPT_TYPE_DOUBLE,
+
+	/**
+	 * Options that take a number followed by a unit, that is scaled
+	 * as it's parsed and stored in the `value` pointer, a `uint64_t`.
+	 * The number may have a fraction (for example, "1.5G"); a result
+	 * that isn't whole is truncated.
+	 *
+	 * `ADOPT_TYPE_SIZE` is stored in bytes; the unit is one of "B",
+	 * "K", "M", "G", "T", "P" or "E" (in powers of 1024), optionally
+	 * followed by "B" or "iB", and is case insensitive.  A number
+	 * without a unit is in bytes.
+	 *
+	 * `ADOPT_TYPE_DURATION` is stored in nanoseconds; the unit is
+	 * one of "ns", "us", "ms", "s", "m", "h" or "d".  A number
+	 * without a unit is in seconds.
+	 *
+	 * `ADOPT_TYPE_RATIO` is stored in parts per million; the unit is
+	 * "%" or "ppm".  A number without a unit is a fraction of 1 (so
+	 * "0.5" is 500000).
+	 *
+	 * An unknown unit fails with `ADOPT_STATUS_UNKNOWN_UNIT`, and a
+	 * value too large for a `uint64_t` fails with
+	 * `ADOPT_STATUS_VALUE_OUT_OF_RANGE`.
+	 */
+	ADOPT_TYPE_SIZE,
+	ADOPT_TYPE_DURATION,
+	ADOPT_TYPE_RATIO,
+
+	/**
+	 * An option that takes one of a fixed set of values, for example
+	 * `--format=json`.  The spec's `data` is an array of
+	 * `adopt_enum_value`s naming the allowed values; the `value`
+	 * pointer is an `int` that is set to the given value's `value`.
+	 * Any other value fails with `ADOPT_STATUS_UNKNOWN_VALUE`.
+	 */
+	ADOPT_TYPE_ENUM,
+
+	/**
+	 * Options that take a list of items separated by a delimiter,
+	 * for example `--features=a,b,c`.  The delimiter is the spec's
+	 * `switch_value`, or ',' if it's 0.  The option may be given
+	 * more than once, and each value's items are added to those
+	 * already given.
+	 *
+	 * `ADOPT_TYPE_LIST` splits the value into an `adopt_list`
+	 * (without copying the items); `ADOPT_TYPE_INT_LIST` converts
+	 * each item (like `ADOPT_TYPE_INT64`) into an `adopt_int_list`;
+	 * and `ADOPT_TYPE_BITMASK` looks up each item in the spec's
+	 * `data`, an array of `adopt_enum_value`s (like an
+	 * `ADOPT_TYPE_ENUM`), and ORs its `value` into an `int`.
+	 */
+	ADOPT_TYPE_LIST,
+	ADOPT_TYPE_INT_LIST,
+	ADOPT_TYPE_BITMASK,
+
+	/**
+	 * An option that takes a list of sub-options, like `getsubopt`;
+	 * for example, `-o ro,uid=1000,cache=loose`.  The items are
+	 * separated by the spec's `switch_value`, or ',' if it's 0.  The
+	 * spec's `data` is an array of `adopt_spec`s for the sub-options,
+	 * terminated by one of type `ADOPT_TYPE_NONE`; each item is a
+	 * sub-option's `name`, followed by an '=' and a value if it
+	 * takes one.  Each sub-option is stored in its own `value`
+	 * pointer, as an option of that type would be, except that an
+	 * `ADOPT_TYPE_VALUE` sub-option is stored as an `adopt_slice`
+	 * pointing into the value.  When parsing into a result block,
+	 * they're stored in the block given in this spec's result
+	 * instead (see `adopt_value`).  An unknown sub-option fails with
+	 * `ADOPT_STATUS_UNKNOWN_VALUE`.
+	 *
+	 * Sub-options may be a boolean, switch, accumulator, value,
+	 * numeric, enum or list type; other types fail with
+	 * `ADOPT_STATUS_INVALID_VALUE`, and `adopt_spec_compile` rejects
+	 * them.
+	 */
+	ADOPT_TYPE_SUBOPTS,
+
+	/**
+	 * An option that takes a "key=value" definition, and that may be
+	 * given any number of times, for example `-D name=value`.  Each
+	 * definition is split at its first '=' and appended to an
+	 * `adopt_key_values`, without copying.
+	 */
+	ADOPT_TYPE_KEY_VALUES,
+
+	/**
+	 * Options that take several of the following arguments (words)
+	 * as their value, for example `--point X Y Z`.
+	 * `ADOPT_TYPE_WORDS` takes `switch_value` words; a
+	 * `ADOPT_TYPE_WORDS_UNTIL` takes the words up to a terminator,
+	 * the string in the spec's `data` (or ";" if it's `NULL`), like
+	 * `-exec cmd args ... ;`, and the terminator is consumed.  The
+	 * words are taken as given, even if they look like options, and
+	 * can't be attached to the option (as in "--point=X").  If there
+	 * are too few words, or no terminator, parsing fails with
+	 * `ADOPT_STATUS_MISSING_VALUE`.
+	 *
+	 * The words are stored in an `adopt_words` that points into the
+	 * arguments, without copying them; with GNU-style reordering, it
+	 * is updated when the words are moved.  These can't be parsed
+	 * from an `adopt_source`, since its arguments are not retained.
+	 */
+	ADOPT_TYPE_WORDS,
+	ADOPT_TYPE_WORDS_UNTIL,
 } adopt_type_t;
 
 /**
@@ -131,8 +261,52 @@ typedef enum {
 	 * environment variable is ignored.
 	 */
 	ADOPT_PARSE_FORCE_GNU = (1u << 1),
+
+	/**
+	 * When parsing with GNU `getopt_long` style behavior, do not
+	 * reorder the arguments given.  Options are parsed where they
+	 * appear, then the bare arguments are parsed afterward.  An
+	 * `ADOPT_TYPE_ARGS` spec's `value` is not set in this mode,
+	 * since its arguments are not contiguous; use the `args`
+	 * iterator in the `adopt_opt` instead.
+	 */
+	ADOPT_PARSE_PRESERVE_ARGS = (1u << 2),
+
+	/**
+	 * Expand response files: an argument "@file" is replaced by the
+	 * arguments contained in `file`, which may themselves name
+	 * response files.  The arguments point into the response file,
+	 * so they are only valid until `adopt_parser_dispose` is called.
+	 * This is only supported by `adopt_parser_init`; the functions
+	 * that parse in one call, like `adopt_parse`, fail with
+	 * `ADOPT_STATUS_UNSUPPORTED_FLAGS`.  To use response files with
+	 * them, expand them with `adopt_response_expand` first.
+	 */
+	ADOPT_PARSE_RESPONSE_FILES = (1u << 3),
+
+	/**
+	 * Copy the values that are stored (in a spec's `value`, or in the
+	 * `adopt_opt`'s `value`) into the parser's arena, so that they
+	 * remain valid after the arguments are reused or freed.  The
+	 * arguments of an `ADOPT_TYPE_ARGS` spec's `value` are copied,
+	 * but the `adopt_opt`'s `arg` and `args` are not.  This requires
+	 * an arena; see `adopt_parser_set_arena`.
+	 */
+	ADOPT_PARSE_COPY_VALUES = (1u << 4),
 } adopt_flag_t;
 
+/**
+ * An allowed value of an `ADOPT_TYPE_ENUM`; an array of these is
+ * terminated by one with a `NULL` name.
+ */
+typedef struct adopt_enum_value {
+	/** The value, as given on the command line. */
+	const char *name;
+
+	/** The number that the spec's `value` is set to. */
+	int value;
+} adopt_enum_value;
+
 /** Specification for an available option. */
 typedef struct adopt_spec {
 	/** Type of option expected. */
@@ -165,6 +339,37 @@ typedef struct adopt_spec {
 	 * If this spec is of type `ADOPT_TYPE_ARGS`, this is a pointer
 	 * to a `char **` that will be set to the remaining values
 	 * specified on the command line.
+	 *
+	 * If this spec is of type `ADOPT_TYPE_VALUES`, this is a pointer
+	 * to an `adopt_values` that each value will be appended to.
+	 *
+	 * If this spec is of a numeric type, like `ADOPT_TYPE_INT32`,
+	 * this is a pointer to a number of that type that will be set to
+	 * the converted value.  For `ADOPT_TYPE_SIZE`,
+	 * `ADOPT_TYPE_DURATION` and `ADOPT_TYPE_RATIO`, this is a pointer
+	 * to a `uint64_t`.
+	 *
+	 * If this spec is of type `ADOPT_TYPE_ENUM`, this is a pointer
+	 * to an `int` that will be set to the given value's number.
+	 *
+	 * If this spec is of type `ADOPT_TYPE_LIST` or
+	 * `ADOPT_TYPE_INT_LIST`, this is a pointer to an `adopt_list` or
+	 * `adopt_int_list` that the items will be appended to.  If this
+	 * spec is of type `ADOPT_TYPE_BITMASK`, this is a pointer to an
+	 * `int` that the items' numbers will be ORed into.
+	 *
+	 * If this spec is of type `ADOPT_TYPE_SUBOPTS`, this is ignored;
+	 * the sub-options are stored in their own `value` pointers.  If
+	 * this spec is of type `ADOPT_TYPE_KEY_VALUES`, this is a pointer
+	 * to an `adopt_key_values` that each definition is appended to.
+	 *
+	 * If this spec is of type `ADOPT_TYPE_WORDS` or
+	 * `ADOPT_TYPE_WORDS_UNTIL`, this is a pointer to an `adopt_words`
+	 * that will be set to the words given.
+	 *
+	 * When parsing into a configuration structure (see
+	 * `adopt_parse_config`), this is instead the location of the
+	 * member in that structure, given with `ADOPT_OFFSET`.
 	 */
 	void *value;
 
@@ -173,7 +378,11 @@ typedef struct adopt_spec {
 	 * to set in the option's `value` pointer when it is specified.  If
 	 * this spec is of type `ADOPT_TYPE_ACCUMULATOR`, this is the value
 	 * to increment in the option's `value` pointer when it is
-	 * specified.  This is ignored for other opt types.
+	 * specified.  If this spec is a list type, like
+	 * `ADOPT_TYPE_LIST`, or an `ADOPT_TYPE_SUBOPTS`, this is the
+	 * delimiter between items.  If this spec is of type
+	 * `ADOPT_TYPE_WORDS`, this is the number of words.  This
+	 * is ignored for other opt types.
 	 */
 	int switch_value;
 
@@ -186,8 +395,10 @@ typedef struct adopt_spec {
 	/**
 	 * The name of the value, provided when creating usage information.
 	 * This is required only for the functions that display usage
-	 * information and only when a spec is of type `ADOPT_TYPE_VALUE,
-	 * `ADOPT_TYPE_ARG` or `ADOPT_TYPE_ARGS``.
+	 * information and only when a spec is of type `ADOPT_TYPE_VALUE`,
+	 * `ADOPT_TYPE_VALUES`, a numeric type, `ADOPT_TYPE_ENUM`, a list
+	 * type, `ADOPT_TYPE_SUBOPTS`, `ADOPT_TYPE_KEY_VALUES`, a words
+	 * type, `ADOPT_TYPE_ARG` or `ADOPT_TYPE_ARGS`.
 	 */
 	const char *value_name;
 
@@ -196,8 +407,27 @@ typedef struct adopt_spec {
 	 * end-user.  This is only used when creating usage information.
 	 */
 	const char *help;
+
+	/**
+	 * Additional data for the type.  If this spec is of type
+	 * `ADOPT_TYPE_ENUM` or `ADOPT_TYPE_BITMASK`, this is the array of
+	 * `adopt_enum_value`s that are allowed.  If this spec is of type
+	 * `ADOPT_TYPE_SUBOPTS`, this is the array of `adopt_spec`s for
+	 * its sub-options.  If this spec is of type
+	 * `ADOPT_TYPE_WORDS_UNTIL`, this is the terminating string.
+	 */
+	const void *data;
 } adopt_spec;
 
+/**
+ * The `value` of a spec that is parsed into the given member of a
+ * configuration structure, rather than through a pointer; see
+ * `adopt_parse_config`.  This is never NULL, even for the first
+ * member, so specs without a value are still distinguished.
+ */
+#define ADOPT_OFFSET(type, member) \
+	((void *)(uintptr_t)(offsetof(type, member) + 1))
+
 /** Return value for `adopt_parser_next`. */
 typedef enum {
 	/** Parsing is complete; there are no more arguments. */
@@ -223,8 +453,296 @@ typedef enum {
 
 	/** A required argument was not provided. */
 	ADOPT_STATUS_MISSING_ARGUMENT = 4,
+
+	/** Memory could not be allocated to track the parsed arguments. */
+	ADOPT_STATUS_OUT_OF_MEMORY = 5,
+
+	/**
+	 * A response file could not be read, or it includes itself;
+	 * `arg` is the argument naming the file.
+	 */
+	ADOPT_STATUS_INVALID_RESPONSE_FILE = 6,
+
+	/** The arguments could not be read from an `adopt_source`. */
+	ADOPT_STATUS_SOURCE_ERROR = 7,
+
+	/**
+	 * A command string could not be split into arguments; it has an
+	 * unterminated quote or escape, or too many arguments.
+	 */
+	ADOPT_STATUS_INVALID_STRING = 8,
+
+	/**
+	 * The value given to a numeric option could not be converted;
+	 * `value` is the value that was given.
+	 */
+	ADOPT_STATUS_INVALID_VALUE = 9,
+
+	/**
+	 * The value given to a numeric option is too large or too small
+	 * for its type; `value` is the value that was given.
+	 */
+	ADOPT_STATUS_VALUE_OUT_OF_RANGE = 10,
+
+	/**
+	 * The value given to a size, duration or ratio option has a unit
+	 * that isn't known; `value` is the value that was given.
+	 */
+	ADOPT_STATUS_UNKNOWN_UNIT = 11,
+
+	/**
+	 * The value given to an `ADOPT_TYPE_ENUM` option (or an item of
+	 * an `ADOPT_TYPE_BITMASK` or `ADOPT_TYPE_SUBOPTS`) is not one of
+	 * the allowed values; `value` is the value that was given.
+	 */
+	ADOPT_STATUS_UNKNOWN_VALUE = 12,
+
+	/**
+	 * The parsing flags include one that isn't supported by the
+	 * function or parser that was used, for example
+	 * `ADOPT_PARSE_RESPONSE_FILES` with `adopt_parse`.
+	 */
+	ADOPT_STATUS_UNSUPPORTED_FLAGS = 13,
 } adopt_status_t;
 
+/**
+ * A compiled index over an array of `adopt_spec`s, produced by
+ * `adopt_spec_compile`.  The index is immutable once compiled and
+ * may be shared by any number of parsers.
+ */
+typedef struct adopt_index adopt_index;
+
+/**
+ * The arguments produced by expanding response files, created by
+ * `adopt_response_expand`.
+ */
+typedef struct adopt_response adopt_response;
+
+/**
+ * An argument given as a pointer and a length, which need not be
+ * NUL-terminated; see `adopt_parser_init_slices`.
+ */
+typedef struct adopt_slice {
+	char *ptr;
+	size_t len;
+} adopt_slice;
+
+/**
+ * The values given to an `ADOPT_TYPE_VALUES` spec.  This should be
+ * zeroed before parsing; each value is appended to it.
+ *
+ * The first time the array needs to grow, the remaining arguments are
+ * counted, so that it's allocated once, at its final size.  It's
+ * allocated from the parser's arena, if it has one (see
+ * `adopt_parser_set_arena`); otherwise, it's allocated with `malloc`
+ * and the caller should `free` it.
+ */
+typedef struct adopt_values {
+	/** The values, in the order given, followed by a `NULL`. */
+	char **values;
+
+	/**
+	 * The values, in the order given, when parsing slices (see
+	 * `adopt_parser_init_slices`); `values` is not set.
+	 */
+	adopt_slice *slices;
+
+	/** The number of values. */
+	size_t len;
+
+	/** The number of values that have been allocated. */
+	size_t alloc;
+} adopt_values;
+
+/**
+ * The items given to an `ADOPT_TYPE_LIST` spec.  This should be zeroed
+ * before parsing; the items of each value are appended to it.  The
+ * items point into the value (they are not NUL-terminated).  The array
+ * is allocated like an `adopt_values`.
+ */
+typedef struct adopt_list {
+	/** The items, in the order given. */
+	adopt_slice *items;
+
+	/** The number of items. */
+	size_t len;
+} adopt_list;
+
+/**
+ * The items given to an `ADOPT_TYPE_INT_LIST` spec, converted to
+ * integers; it's otherwise like an `adopt_list`.
+ */
+typedef struct adopt_int_list {
+	/** The items, in the order given. */
+	int64_t *items;
+
+	/** The number of items. */
+	size_t len;
+} adopt_int_list;
+
+/**
+ * The words given to an `ADOPT_TYPE_WORDS` or `ADOPT_TYPE_WORDS_UNTIL`
+ * spec.
+ */
+typedef struct adopt_words {
+	/** The words, in the arguments; `NULL` when parsing slices. */
+	char **args;
+
+	/** The words, when parsing slices. */
+	const adopt_slice *slices;
+
+	/** The number of words. */
+	size_t len;
+} adopt_words;
+
+/** A definition given to an `ADOPT_TYPE_KEY_VALUES` spec. */
+typedef struct adopt_key_value {
+	/** The key, preceding the first '='. */
+	adopt_slice key;
+
+	/**
+	 * The value, following the first '='; if there is no '=', its
+	 * `ptr` is `NULL`.
+	 */
+	adopt_slice value;
+} adopt_key_value;
+
+/**
+ * The definitions given to an `ADOPT_TYPE_KEY_VALUES` spec.  This
+ * should be zeroed before parsing, and is allocated like an
+ * `adopt_values`.
+ */
+typedef struct adopt_key_values {
+	/** The definitions, in the order given. */
+	adopt_key_value *items;
+
+	/** The number of definitions. */
+	size_t len;
+
+	/** The number of definitions that have been allocated. */
+	size_t alloc;
+} adopt_key_values;
+
+/**
+ * A caller-provided buffer that values are allocated from, by
+ * advancing through it; see `adopt_parser_set_arena`.
+ */
+typedef struct adopt_arena {
+	char *buf;
+	size_t size;
+	size_t len;
+} adopt_arena;
+
+/**
+ * A parsed value in a result block; see `adopt_parse_index`.  A
+ * result block has one `adopt_value` for each spec, at the same
+ * position as the spec, and each is written as the spec's `value`
+ * pointer would be.
+ */
+typedef union adopt_value {
+	/**
+	 * The value of an `ADOPT_TYPE_BOOL`, `ADOPT_TYPE_SWITCH`,
+	 * `ADOPT_TYPE_ACCUMULATOR`, `ADOPT_TYPE_ENUM` or
+	 * `ADOPT_TYPE_BITMASK`.
+	 */
+	int i;
+
+	/** The value of an `ADOPT_TYPE_VALUE` or `ADOPT_TYPE_ARG`. */
+	char *s;
+
+	/** The arguments given to an `ADOPT_TYPE_ARGS`. */
+	char **a;
+
+	/** The values given to an `ADOPT_TYPE_VALUES`. */
+	adopt_values v;
+
+	/** The value of an `ADOPT_TYPE_INT32`. */
+	int32_t i32;
+
+	/** The value of an `ADOPT_TYPE_UINT32`. */
+	uint32_t u32;
+
+	/** The value of an `ADOPT_TYPE_INT64`. */
+	int64_t i64;
+
+	/**
+	 * The value of an `ADOPT_TYPE_UINT64`, `ADOPT_TYPE_SIZE`,
+	 * `ADOPT_TYPE_DURATION` or `ADOPT_TYPE_RATIO`.
+	 */
+	uint64_t u64;
+
+	/** The value of an `ADOPT_TYPE_DOUBLE`. */
+	double d;
+
+	/** The items given to an `ADOPT_TYPE_LIST`. */
+	adopt_list l;
+
+	/** The items given to an `ADOPT_TYPE_INT_LIST`. */
+	adopt_int_list il;
+
+	/** The definitions given to an `ADOPT_TYPE_KEY_VALUES`. */
+	adopt_key_values kv;
+
+	/**
+	 * The words given to an `ADOPT_TYPE_WORDS` or
+	 * `ADOPT_TYPE_WORDS_UNTIL`.
+	 */
+	adopt_words w;
+
+	/** The value of an `ADOPT_TYPE_VALUE` sub-option. */
+	adopt_slice slice;
+
+	/**
+	 * The result block for the sub-options of an
+	 * `ADOPT_TYPE_SUBOPTS`, with one `adopt_value` for each
+	 * sub-option, at the same position as the sub-option.  The
+	 * caller sets this before parsing; if it's NULL, the sub-options
+	 * are validated but not stored.
+	 */
+	union adopt_value *sub;
+} adopt_value;
+
+/**
+ * An iterator over the arguments given to an `ADOPT_TYPE_ARGS` spec;
+ * use `adopt_args_next` to retrieve each argument.  Callers should
+ * not modify this structure.
+ */
+typedef struct adopt_args_iter {
+	const adopt_spec *specs;
+	const adopt_index *index;
+	char **args;
+	size_t args_len;
+	size_t idx;
+	size_t stop;
+} adopt_args_iter;
+
+/**
+ * The kind of an argument, as classified by `adopt_parser_classify`;
+ * use `ADOPT_TAG_KIND` to get the kind from an `adopt_tag`.
+ */
+typedef enum {
+	/** An argument that does not begin with a '-' */
+	ADOPT_TAG_BARE = 0,
+
+	/** A short option (or cluster of them), beginning with a '-' */
+	ADOPT_TAG_SHORT = 1,
+
+	/** A long option, beginning with "--" */
+	ADOPT_TAG_LONG = 2,
+
+	/** A literal "--" */
+	ADOPT_TAG_LITERAL = 3
+} adopt_tag_t;
+
+/**
+ * The classification of an argument.  The low bits hold its
+ * `adopt_tag_t` kind; for long options, the remaining bits hold the
+ * length of the option name and whether it is followed by an '='.
+ */
+typedef unsigned int adopt_tag;
+
+#define ADOPT_TAG_KIND(tag) ((adopt_tag_t)((tag) & 0x3))
+
 /** An option provided on the command-line. */
 typedef struct adopt_opt {
 	/** The status of parsing the most recent argument. */
@@ -248,28 +766,136 @@ typedef struct adopt_opt {
 	 */
 	char *value;
 
+	/**
+	 * When parsing slices, the length of `arg`, which is not
+	 * NUL-terminated; otherwise, 0.
+	 */
+	size_t arg_len;
+
+	/**
+	 * When parsing slices, the length of `value`, which is not
+	 * NUL-terminated; otherwise, 0.
+	 */
+	size_t value_len;
+
 	/**
 	 * If the argument is of type `ADOPT_ARGS`, this is the number of
 	 * arguments remaining.  This value is persisted even when parsing
 	 * is complete and `status` == `ADOPT_STATUS_DONE`.
 	 */
 	size_t args_len;
+
+	/**
+	 * If the argument is of type `ADOPT_ARGS`, an iterator over the
+	 * arguments remaining.  Like `args_len`, this is persisted even
+	 * when parsing is complete.
+	 */
+	adopt_args_iter args;
 } adopt_opt;
 
+/**
+ * A source that arguments are read from as they're parsed, instead of
+ * an array of arguments; see `adopt_parser_init_source`.  Custom
+ * sources can embed this structure as their first member.
+ */
+typedef struct adopt_source {
+	/**
+	 * Reads the next argument into `out`.  The argument returned
+	 * must remain valid until the following call returns, since the
+	 * parser may need to look at both.
+	 *
+	 * @return 1 if an argument was read, 0 if there are no more
+	 *         arguments, or -1 on error
+	 */
+	int (*next)(char **out, struct adopt_source *source);
+} adopt_source;
+
+/** The default maximum argument length for an `adopt_fd_source`. */
+#define ADOPT_FD_SOURCE_MAX_LEN 65536
+
+/**
+ * An `adopt_source` that reads delimited arguments from a file
+ * descriptor, for example, the NUL-delimited output of `find -print0`.
+ * Arguments are read into a fixed-size buffer that is reused.  Callers
+ * should not modify this structure.
+ */
+typedef struct adopt_fd_source {
+	adopt_source parent;
+	int fd;
+	char delimiter;
+	char *buf[2];
+	size_t buf_size;
+	size_t start;
+	size_t scan;
+	size_t end;
+	unsigned int current : 1,
+	             eof : 1;
+} adopt_fd_source;
+
+/** A command-line to parse with `adopt_parse_batch`. */
+typedef struct adopt_batch {
+	/** The arguments to parse. */
+	char **args;
+
+	/** The length of the arguments to parse. */
+	size_t args_len;
+
+	/**
+	 * The result block to store the parsed values in, or NULL to use
+	 * each spec's `value`; see `adopt_parse_index`.
+	 */
+	adopt_value *results;
+
+	/**
+	 * The configuration structure to store the parsed values in,
+	 * when the specs are bound with `ADOPT_OFFSET`, or NULL; see
+	 * `adopt_parse_config`.  The caller applies its defaults.
+	 */
+	void *config;
+
+	/**
+	 * The outcome of parsing, as `adopt_parse_index` would provide.
+	 * On success, `opt.status` is `ADOPT_STATUS_DONE`.
+	 */
+	adopt_opt opt;
+} adopt_batch;
+
 /* The internal parser state.  Callers should not modify this structure. */
 typedef struct adopt_parser {
 	const adopt_spec *specs;
+	const adopt_index *index;
+	adopt_value *results;
+	void *config;
 	char **args;
+	const adopt_slice *slices;
+	adopt_tag *tags;
+	const adopt_spec **matches;
+	adopt_arena *arena;
 	size_t args_len;
 	unsigned int flags;
+	adopt_response *response;
+	adopt_status_t response_status;
+	adopt_source *source;
+	char *window[2];
+	size_t window_len;
 
 	/* Parser state */
 	size_t idx;
 	size_t arg_idx;
 	size_t in_args;
 	size_t in_short;
+	size_t args_idx;
+	size_t args_stop;
+	size_t bare_idx;
+	size_t bare_stop;
 	unsigned int needs_sort : 1,
-	             in_literal : 1;
+	             in_literal : 1,
+	             in_gnu_opts : 1,
+	             in_gnu_args : 1,
+	             source_eof : 1,
+	             source_failed : 1,
+	             sort_words : 1,
+	             invalid_flags : 1;
 } adopt_parser;
 
 /**
@@ -293,6 +919,74 @@ adopt_status_t adopt_parse(
     size_t args_len,
     unsigned int flags);
 
+/**
+ * Parses all the command-line arguments into the given configuration
+ * structure, like `adopt_parse`, with the specs bound to its members
+ * with `ADOPT_OFFSET`.  The structure is first initialized by copying
+ * the given defaults over it, so that it needn't be reset separately
+ * for each parse.  Since the specs aren't modified, the same specs
+ * may be used to parse into several structures at once.
+ *
+ * @param opt The The `adopt_opt` information that failed parsing
+ * @param specs A NULL-terminated array of `adopt_spec`s that can be parsed
+ * @param config The configuration structure to store the values in
+ * @param defaults A configuration structure with the default values
+ *        to copy into `config` before parsing, or NULL to leave
+ *        `config` as it is
+ * @param config_size The size of the configuration structure
+ * @param args The arguments that will be parsed
+ * @param args_len The length of arguments to be parsed
+ * @param flags The `adopt_flag_t flags for parsing
+ */
+adopt_status_t adopt_parse_config(
+	adopt_opt *opt,
+	const adopt_spec specs[],
+	void *config,
+	const void *defaults,
+	size_t config_size,
+	char **args,
+	size_t args_len,
+	unsigned int flags);
+
+/**
+ * Splits a command string into arguments, following the POSIX shell
+ * rules for blanks, quotes and backslashes (but without performing
+ * any expansions).  The string is modified in place, and the
+ * arguments point into it.
+ *
+ * @param args The array to store the arguments in
+ * @param args_len Pointer to store the number of arguments
+ * @param args_size The number of arguments that `args` can hold
+ * @param str The string to split, which will be modified
+ * @return 0 on success, or -1 if the string has an unterminated quote
+ *         or escape, or more than `args_size` arguments
+ */
+int adopt_tokenize(
+	char **args,
+	size_t *args_len,
+	size_t args_size,
+	char *str);
+
+/**
+ * Splits a command string into arguments with `adopt_tokenize`, then
+ * parses them with `adopt_parse`.  No memory is allocated; the
+ * arguments are stored in `args` and point into `str`.
+ *
+ * @param opt The The `adopt_opt` information that failed parsing
+ * @param specs A NULL-terminated array of `adopt_spec`s that can be parsed
+ * @param str The command string to parse, which will be modified
+ * @param args The array to store the arguments in
+ * @param args_size The number of arguments that `args` can hold
+ * @param flags The `adopt_flag_t flags for parsing
+ */
+adopt_status_t adopt_parse_string(
+	adopt_opt *opt,
+	const adopt_spec specs[],
+	char *str,
+	char **args,
+	size_t args_size,
+	unsigned int flags);
+
 /**
  * Quickly executes the given callback for each argument.
  *
@@ -328,6 +1022,348 @@ void adopt_parser_init(
 	size_t args_len,
 	unsigned int flags);
 
+/**
+ * Compiles an index over the given specifications, so that options
+ * can be looked up without scanning the entire specification list
+ * for each argument.  The specifications must remain valid (and
+ * unmodified) for the lifetime of the index.  The `POSIXLY_CORRECT`
+ * environment variable is examined once, when the index is compiled.
+ *
+ * @param out Pointer to store the newly compiled index
+ * @param specs A NULL-terminated array of `adopt_spec`s to index
+ * @return 0 on success, -1 on failure
+ */
+int adopt_spec_compile(adopt_index **out, const adopt_spec specs[]);
+
+/**
+ * Frees an index created by `adopt_spec_compile`.
+ *
+ * @param index The index to free
+ */
+void adopt_index_free(adopt_index *index);
+
+/**
+ * Initializes a parser that parses the given arguments according to
+ * the specifications in the given compiled index.
+ *
+ * @param parser The `adopt_parser` that will be initialized
+ * @param index The `adopt_index` produced by `adopt_spec_compile`
+ * @param args The arguments that will be parsed
+ * @param args_len The length of arguments to be parsed
+ * @param flags The `adopt_flag_t flags for parsing
+ */
+void adopt_parser_init_index(
+	adopt_parser *parser,
+	const adopt_index *index,
+	char **args,
+	size_t args_len,
+	unsigned int flags);
+
+/**
+ * Initializes a parser that parses the given arguments according to
+ * the specifications in the given compiled index, writing parsed
+ * values into the given result block instead of through each spec's
+ * `value` pointer.  Since neither the index nor the specifications
+ * are modified, any number of parsers may share them concurrently.
+ *
+ * @param parser The `adopt_parser` that will be initialized
+ * @param index The `adopt_index` produced by `adopt_spec_compile`
+ * @param results An array of `adopt_index_len` values to store the
+ *        parsed values in, or NULL to use each spec's `value`
+ * @param args The arguments that will be parsed
+ * @param args_len The length of arguments to be parsed
+ * @param flags The `adopt_flag_t flags for parsing
+ */
+void adopt_parser_init_results(
+	adopt_parser *parser,
+	const adopt_index *index,
+	adopt_value *results,
+	char **args,
+	size_t args_len,
+	unsigned int flags);
+
+/**
+ * Parses all the command-line arguments according to the given
+ * compiled index, like `adopt_parse`.  Parsed values are written
+ * into the given result block; values for specs that were not given
+ * are left untouched, so the caller should initialize it.
+ *
+ * @param opt The The `adopt_opt` information that failed parsing
+ * @param index The `adopt_index` produced by `adopt_spec_compile`
+ * @param results An array of `adopt_index_len` values to store the
+ *        parsed values in, or NULL to use each spec's `value`
+ * @param args The arguments that will be parsed
+ * @param args_len The length of arguments to be parsed
+ * @param flags The `adopt_flag_t flags for parsing
+ */
+adopt_status_t adopt_parse_index(
+	adopt_opt *opt,
+	const adopt_index *index,
+	adopt_value *results,
+	char **args,
+	size_t args_len,
+	unsigned int flags);
+
+/**
+ * Parses a batch of command-lines according to the given compiled
+ * index, as `adopt_parse_index` would parse each of them, reusing
+ * the parsing setup across the batch.
+ *
+ * When adopt is compiled with `ADOPT_THREADS` defined, the batch may
+ * be split across a number of threads; in that case, each command-line
+ * should have its own result block, since the specs' `value` pointers
+ * would be shared between threads.  Otherwise, the batch is parsed in
+ * the calling thread.
+ *
+ * @param index The `adopt_index` produced by `adopt_spec_compile`
+ * @param batch The command-lines to parse
+ * @param batch_len The number of command-lines to parse
+ * @param flags The `adopt_flag_t flags for parsing
+ * @param threads The number of threads to use, or 0 or 1 to parse
+ *        in the calling thread
+ * @return The number of command-lines that were not parsed successfully
+ */
+size_t adopt_parse_batch(
+	const adopt_index *index,
+	adopt_batch *batch,
+	size_t batch_len,
+	unsigned int flags,
+	unsigned int threads);
+
+/**
+ * Parses all the command-line arguments according to the given
+ * compiled index, as `adopt_parse_index` does, but classifies the
+ * arguments and matches them to their specs on a number of threads
+ * first.  The options are then applied in the order given, in the
+ * calling thread, so the results are exactly those of
+ * `adopt_parse_index`.  This is useful for very large numbers of
+ * arguments; smaller inputs are parsed in the calling thread.
+ *
+ * When adopt is not compiled with `ADOPT_THREADS` defined, this is
+ * equivalent to `adopt_parse_index`.
+ *
+ * @param opt The The `adopt_opt` information that failed parsing
+ * @param index The `adopt_index` produced by `adopt_spec_compile`
+ * @param results An array of `adopt_index_len` values to store the
+ *        parsed values in, or NULL to use each spec's `value`
+ * @param args The arguments that will be parsed
+ * @param args_len The length of arguments to be parsed
+ * @param flags The `adopt_flag_t flags for parsing
+ * @param threads The number of threads to use, or 0 or 1 to parse
+ *        in the calling thread
+ */
+adopt_status_t adopt_parse_parallel(
+	adopt_opt *opt,
+	const adopt_index *index,
+	adopt_value *results,
+	char **args,
+	size_t args_len,
+	unsigned int flags,
+	unsigned int threads);
+
+/**
+ * Returns the number of specifications in the given index; this is
+ * the number of values in a result block.
+ *
+ * @param index The `adopt_index` produced by `adopt_spec_compile`
+ * @return The number of specifications
+ */
+size_t adopt_index_len(const adopt_index *index);
+
+/**
+ * Initializes a parser that parses arguments as they are read from the
+ * given source, so that an unbounded number of arguments can be parsed
+ * in constant memory.  Arguments are parsed in the order given; GNU
+ * style reordering and response files are not supported, and the
+ * flags requesting them (`ADOPT_PARSE_GNU`, `ADOPT_PARSE_FORCE_GNU`
+ * and `ADOPT_PARSE_RESPONSE_FILES`) make the first call to
+ * `adopt_parser_next` fail with `ADOPT_STATUS_UNSUPPORTED_FLAGS`.
+ *
+ * Since the arguments are not retained, an `ADOPT_TYPE_ARGS` spec is
+ * returned once for each of its arguments, with `arg` set to the
+ * argument (and its `value` is not set).  Arguments and values,
+ * including those stored in a spec's `value`, are only valid until
+ * the next call to `adopt_parser_next`.  So the types that collect
+ * several values (`ADOPT_TYPE_VALUES`, `ADOPT_TYPE_KEY_VALUES` and
+ * `ADOPT_TYPE_LIST`) need `ADOPT_PARSE_COPY_VALUES` and an arena;
+ * otherwise, they fail with `ADOPT_STATUS_UNSUPPORTED_FLAGS`.
+ *
+ * @param parser The `adopt_parser` that will be initialized
+ * @param specs A NULL-terminated array of `adopt_spec`s that can be parsed
+ * @param source The `adopt_source` to read arguments from
+ * @param flags The `adopt_flag_t flags for parsing
+ */
+void adopt_parser_init_source(
+	adopt_parser *parser,
+	const adopt_spec specs[],
+	adopt_source *source,
+	unsigned int flags);
+
+/**
+ * Initializes a parser that parses arguments given as slices, which
+ * have an explicit length and need not be NUL-terminated.  Options
+ * are matched, and split on '=', using those lengths, so the
+ * arguments are never copied; values are returned as slices, with
+ * `opt->value` and `opt->value_len`.
+ *
+ * The `value` of an `ADOPT_TYPE_VALUE` or `ADOPT_TYPE_ARG` spec is an
+ * `adopt_slice`, and the `value` of an `ADOPT_TYPE_ARGS` spec is an
+ * `adopt_slice *` that points into `args`.  The values of an
+ * `ADOPT_TYPE_VALUES` spec are collected in its `adopt_values`'s
+ * `slices`.  Arguments are parsed in the order given, and the `args` iterator in the `adopt_opt` is
+ * empty.  GNU style reordering and response files are not supported,
+ * and the flags requesting them fail parsing, as with
+ * `adopt_parser_init_source`.
+ *
+ * @param parser The `adopt_parser` that will be initialized
+ * @param specs A NULL-terminated array of `adopt_spec`s that can be parsed
+ * @param args The arguments that will be parsed
+ * @param args_len The length of arguments to be parsed
+ * @param flags The `adopt_flag_t flags for parsing
+ */
+void adopt_parser_init_slices(
+	adopt_parser *parser,
+	const adopt_spec specs[],
+	const adopt_slice *args,
+	size_t args_len,
+	unsigned int flags);
+
+/**
+ * Classifies each of the parser's arguments up-front, storing the
+ * kind of each argument (and the position of any '=' in a long
+ * option) in `tags`, so that `adopt_parser_next` need not examine
+ * each argument again to decide how to parse it.  The tags also
+ * remember how options were matched while sorting, so this is most
+ * useful for GNU-style parsing of very large numbers of arguments.
+ *
+ * The parser must have been initialized with an array of arguments
+ * (not a source or slices).  The tags must hold `parser->args_len`
+ * values (the number of arguments after any response files were
+ * expanded), and must remain valid while the parser is used.
+ *
+ * @param parser The `adopt_parser` whose arguments will be classified
+ * @param tags The array of tags to store the classification in
+ * @return 0 on success, -1 if the parser's arguments can't be classified
+ */
+int adopt_parser_classify(adopt_parser *parser, adopt_tag *tags);
+
+/**
+ * Initializes an arena over the given buffer.
+ *
+ * @param arena The `adopt_arena` that will be initialized
+ * @param buf The buffer to allocate from
+ * @param size The size of the buffer, in bytes
+ */
+void adopt_arena_init(adopt_arena *arena, void *buf, size_t size);
+
+/**
+ * Resets an arena, so that its buffer can be reused.  Anything
+ * previously allocated from the arena is no longer valid.
+ *
+ * @param arena The `adopt_arena` to reset
+ */
+void adopt_arena_reset(adopt_arena *arena);
+
+/**
+ * Allocates the parser's `ADOPT_TYPE_VALUES` arrays from the given
+ * arena, instead of with `malloc`, along with the copies of values
+ * when parsing with `ADOPT_PARSE_COPY_VALUES`.  If the arena is
+ * exhausted, parsing fails with `ADOPT_STATUS_OUT_OF_MEMORY`.
+ *
+ * @param parser The `adopt_parser` to allocate values for
+ * @param arena The `adopt_arena` to allocate from, or NULL to use `malloc`
+ */
+void adopt_parser_set_arena(adopt_parser *parser, adopt_arena *arena);
+
+/**
+ * Parses into the given configuration structure, rather than through
+ * each spec's `value` pointer; the specs' values are the locations of
+ * the members, given with `ADOPT_OFFSET`.  This includes the values
+ * of sub-options (see `ADOPT_TYPE_SUBOPTS`).  When the parser has a
+ * result block, the result block is used for the specs instead.
+ *
+ * @param parser The `adopt_parser` to store values for
+ * @param config The configuration structure to store values in, or
+ *        NULL to use each spec's `value` as a pointer
+ */
+void adopt_parser_set_config(adopt_parser *parser, void *config);
+
+/**
+ * Initializes an `adopt_source` that reads arguments from a file
+ * descriptor, separated by the given delimiter (typically `'\0'` or
+ * `'\n'`).  Arguments longer than `max_len` produce a read error.
+ *
+ * @param source The `adopt_fd_source` to initialize
+ * @param fd The file descriptor to read from
+ * @param delimiter The character that separates arguments
+ * @param max_len The maximum length of an argument, or 0 for
+ *        `ADOPT_FD_SOURCE_MAX_LEN`
+ * @return 0 on success, -1 on failure
+ */
+int adopt_fd_source_init(
+	adopt_fd_source *source,
+	int fd,
+	char delimiter,
+	size_t max_len);
+
+/**
+ * Frees the buffer of an `adopt_fd_source`.  The file descriptor is
+ * not closed.
+ *
+ * @param source The `adopt_fd_source` to dispose
+ */
+void adopt_fd_source_dispose(adopt_fd_source *source);
+
+/**
+ * Frees the resources held by a parser, such as the response files
+ * expanded with `ADOPT_PARSE_RESPONSE_FILES`.  Arguments and values
+ * that pointed into those files are no longer valid.
+ *
+ * @param parser The `adopt_parser` to dispose
+ */
+void adopt_parser_dispose(adopt_parser *parser);
+
+/**
+ * Expands the response files in the given arguments: each argument
+ * "@file" is replaced by the arguments in `file`, which are separated
+ * by whitespace and may be quoted with single or double quotes, or
+ * escaped with a backslash.  Response files may name other response
+ * files, relative to the current directory.
+ *
+ * Files are memory-mapped and tokenized in place, so the expanded
+ * arguments remain valid until the response is freed.  `out` is set
+ * even when expansion fails (unless memory could not be allocated),
+ * since `opt` refers to the failing argument; it must be freed with
+ * `adopt_response_free`.
+ *
+ * @param out Pointer to store the expanded response
+ * @param opt The `adopt_opt` to store the status of expansion in
+ * @param args The arguments to expand
+ * @param args_len The length of arguments to expand
+ * @return `ADOPT_STATUS_OK` on success, or an error status
+ */
+adopt_status_t adopt_response_expand(
+	adopt_response **out,
+	adopt_opt *opt,
+	char **args,
+	size_t args_len);
+
+/**
+ * Returns the arguments produced by expanding response files.
+ *
+ * @param args_len Pointer to store the length of the arguments
+ * @param response The `adopt_response` from `adopt_response_expand`
+ * @return The expanded arguments
+ */
+char **adopt_response_args(size_t *args_len, const adopt_response *response);
+
+/**
+ * Frees a response created by `adopt_response_expand`.
+ *
+ * @param response The response to free
+ */
+void adopt_response_free(adopt_response *response);
+
 /**
  * Parses the next command-line argument and places the information about
  * the argument into the given `opt` data.
@@ -342,6 +1378,14 @@ adopt_status_t adopt_parser_next(
 	adopt_opt *opt,
 	adopt_parser *parser);
 
+/**
+ * Retrieves the next argument given to an `ADOPT_TYPE_ARGS` spec.
+ *
+ * @param iter The `adopt_args_iter` from the `adopt_opt`
+ * @return The next argument, or NULL if there are no more arguments
+ */
+char *adopt_args_next(adopt_args_iter *iter);
+
 /**
  * Prints the status after parsing the most recent argument.  This is
  * useful for printing an error message when an unknown argument was
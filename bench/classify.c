@@ -0,0 +1,165 @@
+/*
+ * Copyright (c), Edward Thomson <ethomson@edwardthomson.com>
+ * All rights reserved.
+ *
+ * This file is part of adopt, distributed under the MIT license.
+ * For full terms and conditions, see the included LICENSE file.
+ */
+
+/*
+ * Measures parsing a million arguments, a mix of long options (with
+ * and without values), short option clusters and bare arguments,
+ * with and without classifying them up-front using
+ * `adopt_parser_classify`.  The classified time includes the time to
+ * classify the arguments.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "adopt.h"
+
+#define ARGS_LEN 1000000
+#define ROUNDS   5
+
+static int verbose = 0, force = 0, recursive = 0;
+static char *name = NULL, *output = NULL;
+static char **files = NULL;
+
+adopt_spec opt_specs[] = {
+	{ ADOPT_TYPE_ACCUMULATOR, "verbose",             'v', &verbose,   0 },
+	{ ADOPT_TYPE_SWITCH,      "force",               'f', &force,     1 },
+	{ ADOPT_TYPE_BOOL,        "recursive",           'r', &recursive, 0 },
+	{ ADOPT_TYPE_VALUE,       "name",                'n', &name,      0 },
+	{ ADOPT_TYPE_VALUE,       "output-directory",    'o', &output,    0 },
+	{ ADOPT_TYPE_ARGS,        NULL,                   0,  &files,     0, 0, "file" },
+	{ 0 }
+};
+
+static double parse(
+	adopt_index *index,
+	char **args,
+	size_t args_len,
+	adopt_tag *tags,
+	unsigned int flags)
+{
+	adopt_parser parser;
+	adopt_opt opt;
+	clock_t start = clock();
+
+	if (index)
+		adopt_parser_init_index(&parser, index, args, args_len, flags);
+	else
+		adopt_parser_init(&parser, opt_specs, args, args_len, flags);
+
+	if (tags && adopt_parser_classify(&parser, tags) < 0)
+		exit(1);
+
+	while (adopt_parser_next(&opt, &parser)) {
+		if (opt.status != ADOPT_STATUS_OK) {
+			fprintf(stderr, "unexpected parse result\n");
+			exit(1);
+		}
+	}
+
+	return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+static void run(
+	const char *label,
+	adopt_index *index,
+	char **names,
+	char **args,
+	adopt_tag *tags,
+	unsigned int flags)
+{
+	double untagged = 0, tagged = 0;
+	size_t i;
+	int round;
+
+	/* Take the best of several rounds; GNU parsing reorders the args */
+	for (round = 0; round < ROUNDS; round++) {
+		double elapsed;
+
+		for (i = 0; i < ARGS_LEN; i++)
+			args[i] = names[i];
+
+		elapsed = parse(index, args, ARGS_LEN, NULL, flags);
+		untagged = (round == 0 || elapsed < untagged) ? elapsed : untagged;
+
+		for (i = 0; i < ARGS_LEN; i++)
+			args[i] = names[i];
+
+		elapsed = parse(index, args, ARGS_LEN, tags, flags);
+		tagged = (round == 0 || elapsed < tagged) ? elapsed : tagged;
+	}
+
+	printf("%-14s %12.1f %12.1f\n", label,
+	       untagged * 1e9 / ARGS_LEN, tagged * 1e9 / ARGS_LEN);
+}
+
+int main(int argc, char **argv)
+{
+	static const char *templates[] = {
+		"--name=value%d",
+		"--output-directory",
+		"/tmp/out%d",
+		"-vfr",
+		"-vv",
+		"--no-recursive",
+		"-nvalue%d",
+		"--force",
+	};
+	char **args, **names;
+	adopt_tag *tags;
+	adopt_index *index;
+	size_t i, templates_len = sizeof(templates) / sizeof(templates[0]);
+
+	(void)argc;
+	(void)argv;
+
+	if ((args = malloc(sizeof(char *) * ARGS_LEN)) == NULL ||
+	    (names = malloc(sizeof(char *) * ARGS_LEN)) == NULL ||
+	    (tags = malloc(sizeof(adopt_tag) * ARGS_LEN)) == NULL ||
+	    adopt_spec_compile(&index, opt_specs) < 0)
+		return 1;
+
+	for (i = 0; i < ARGS_LEN; i++) {
+		if ((names[i] = malloc(32)) == NULL)
+			return 1;
+	}
+
+	printf("%-14s %12s %12s\n", "parser", "ns/arg", "classified");
+
+	/* Options, followed by the bare arguments */
+	for (i = 0; i < ARGS_LEN; i++) {
+		if (i >= ARGS_LEN / 4 * 3)
+			snprintf(names[i], 32, "file%d", (int)i);
+		else
+			snprintf(names[i], 32, templates[i % templates_len], (int)i);
+	}
+
+	run("posix", NULL, names, args, tags, ADOPT_PARSE_DEFAULT);
+	run("posix/index", index, names, args, tags, ADOPT_PARSE_DEFAULT);
+
+	/* Options, with a bare argument after every few */
+	for (i = 0; i < ARGS_LEN; i++) {
+		if (i % 4 == 3)
+			snprintf(names[i], 32, "file%d", (int)i);
+		else
+			snprintf(names[i], 32, templates[(i / 4 * 3 + i % 4) % templates_len], (int)i);
+	}
+
+	run("gnu", NULL, names, args, tags, ADOPT_PARSE_FORCE_GNU);
+	run("gnu/index", index, names, args, tags, ADOPT_PARSE_FORCE_GNU);
+
+	for (i = 0; i < ARGS_LEN; i++)
+		free(names[i]);
+
+	adopt_index_free(index);
+	free(tags);
+	free(names);
+	free(args);
+	return 0;
+}
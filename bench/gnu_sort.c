@@ -0,0 +1,85 @@
+/*
+ * Copyright (c), Edward Thomson <ethomson@edwardthomson.com>
+ * All rights reserved.
+ *
+ * This file is part of adopt, distributed under the MIT license.
+ * For full terms and conditions, see the included LICENSE file.
+ */
+
+/*
+ * Measures GNU-style parsing of interleaved options and arguments,
+ * "file0 -v file1 -v ...", at increasing argument counts.  The time
+ * per argument should stay flat as the argument count grows.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "adopt.h"
+
+static int verbose = 0;
+static char **files = NULL;
+
+adopt_spec opt_specs[] = {
+	{ ADOPT_TYPE_ACCUMULATOR, "verbose", 'v', &verbose, 0 },
+	{ ADOPT_TYPE_ARGS, NULL, 0, &files, 0, 0, "file" },
+	{ 0 }
+};
+
+int main(int argc, char **argv)
+{
+	static const size_t counts[] = { 1000, 10000, 50000, 100000, 200000 };
+	char **args, **names;
+	size_t max = counts[sizeof(counts) / sizeof(counts[0]) - 1];
+	size_t i, j;
+	adopt_opt opt;
+	clock_t start;
+	double elapsed;
+
+	(void)argc;
+	(void)argv;
+
+	if ((args = malloc(sizeof(char *) * max)) == NULL ||
+	    (names = malloc(sizeof(char *) * max)) == NULL)
+		return 1;
+
+	for (i = 0; i < max; i++) {
+		if ((names[i] = malloc(16)) == NULL)
+			return 1;
+
+		if (i % 2)
+			snprintf(names[i], 16, "-v");
+		else
+			snprintf(names[i], 16, "file%d", (int)i);
+	}
+
+	printf("%10s %12s %14s\n", "args", "seconds", "ns/arg");
+
+	for (i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+		for (j = 0; j < counts[i]; j++)
+			args[j] = names[j];
+
+		verbose = 0;
+		start = clock();
+
+		if (adopt_parse(&opt, opt_specs, args, counts[i], ADOPT_PARSE_FORCE_GNU) != 0 ||
+		    verbose != (int)(counts[i] / 2) ||
+		    opt.args_len != counts[i] / 2) {
+			fprintf(stderr, "unexpected parse result\n");
+			return 1;
+		}
+
+		elapsed = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+		printf("%10d %12.4f %14.1f\n", (int)counts[i], elapsed,
+		       elapsed * 1e9 / counts[i]);
+	}
+
+	for (i = 0; i < max; i++)
+		free(names[i]);
+
+	free(names);
+	free(args);
+	return 0;
+}
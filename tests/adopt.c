@@ -1,3 +1,5 @@
+#include <string.h>
+
 #include "clar.h"
 #include "adopt.h"
 
@@ -6,21 +8,16 @@ typedef struct {
 	const char *arg;
 } adopt_expected;
 
-static void test_parse(
-	adopt_spec *specs,
-	char *args[],
-	size_t argslen,
+static void test_parser_expected(
+	adopt_parser *parser,
 	adopt_expected expected[],
 	size_t expectlen)
 {
-	adopt_parser parser;
 	adopt_opt opt;
 	size_t i;
 
-	adopt_parser_init(&parser, specs, args, argslen, ADOPT_PARSE_DEFAULT);
-
 	for (i = 0; i < expectlen; ++i) {
-		cl_assert(adopt_parser_next(&opt, &parser) > 0);
+		cl_assert(adopt_parser_next(&opt, parser) > 0);
 
 		cl_assert_equal_p(expected[i].spec, opt.spec);
 
@@ -32,7 +29,38 @@ static void test_parse(
 			cl_assert(opt.value == NULL);
 	}
 
-	cl_assert(adopt_parser_next(&opt, &parser) == 0);
+	cl_assert(adopt_parser_next(&opt, parser) == 0);
+}
+
+static void test_parse(
+	adopt_spec *specs,
+	char *args[],
+	size_t argslen,
+	adopt_expected expected[],
+	size_t expectlen)
+{
+	adopt_parser parser;
+
+	adopt_parser_init(&parser, specs, args, argslen, ADOPT_PARSE_DEFAULT);
+	test_parser_expected(&parser, expected, expectlen);
+}
+
+static void test_parse_indexed(
+	adopt_spec *specs,
+	char *args[],
+	size_t argslen,
+	adopt_expected expected[],
+	size_t expectlen)
+{
+	adopt_parser parser;
+	adopt_index *index;
+
+	cl_must_pass(adopt_spec_compile(&index, specs));
+
+	adopt_parser_init_index(&parser, index, args, argslen, ADOPT_PARSE_DEFAULT);
+	test_parser_expected(&parser, expected, expectlen);
+
+	adopt_index_free(index);
 }
 
 static void test_returns_missing_value(
@@ -1207,6 +1235,85 @@ void test_adopt__choice_switch_or_arg_advances_arg(void)
 	cl_assert_equal_s("actually_final", final);
 }
 
+void test_adopt__index_choice_consumes_args(void)
+{
+	int foo = 0;
+	char *bar = NULL, *baz = NULL, *qux = NULL, *final = NULL;
+
+	adopt_spec specs[] = {
+		{ ADOPT_TYPE_SWITCH, "foo",  'f', &foo,  'f', 0 },
+		{ ADOPT_TYPE_ARG,    "bar",   0,  &bar,   0,  ADOPT_USAGE_CHOICE },
+		{ ADOPT_TYPE_ARG,    "baz",   0,  &baz,   0,  0 },
+		{ ADOPT_TYPE_SWITCH, "fooz", 'z', &foo,  'z', 0 },
+		{ ADOPT_TYPE_ARG,    "qux",   0,  &qux,   0,  ADOPT_USAGE_CHOICE },
+		{ ADOPT_TYPE_ARG,    "final", 0,  &final, 0,  0 },
+		{ 0 },
+	};
+
+	char *args1[] = { "-f", "one", "-z", "two" };
+	adopt_expected expected1[] = {
+		{ &specs[0], NULL },
+		{ &specs[2], NULL },
+		{ &specs[3], NULL },
+		{ &specs[5], NULL },
+	};
+
+	char *args2[] = { "one", "two", "three" };
+	adopt_expected expected2[] = {
+		{ &specs[1], NULL },
+		{ &specs[2], NULL },
+		{ &specs[4], NULL },
+	};
+
+	/* A switch consumes every argument in its group of choices */
+	test_parse(specs, args1, 4, expected1, 4);
+	test_parse_indexed(specs, args1, 4, expected1, 4);
+
+	cl_assert_equal_i('z', foo);
+	cl_assert_equal_p(NULL, bar);
+	cl_assert_equal_s("one", baz);
+	cl_assert_equal_p(NULL, qux);
+	cl_assert_equal_s("two", final);
+
+	foo = 0;
+	baz = final = NULL;
+
+	test_parse(specs, args2, 3, expected2, 3);
+	test_parse_indexed(specs, args2, 3, expected2, 3);
+
+	cl_assert_equal_i(0, foo);
+	cl_assert_equal_s("one", bar);
+	cl_assert_equal_s("two", baz);
+	cl_assert_equal_s("three", qux);
+	cl_assert_equal_p(NULL, final);
+}
+
+void test_adopt__required_choice_given_last(void)
+{
+	int foo = 0, bar = 0, baz = 0, qux = 0;
+	adopt_opt result;
+
+	adopt_spec specs[] = {
+		{ ADOPT_TYPE_SWITCH, "foo", 'f', &foo, 'f', ADOPT_USAGE_REQUIRED },
+		{ ADOPT_TYPE_SWITCH, "bar", 'b', &bar, 'b', ADOPT_USAGE_CHOICE },
+		{ ADOPT_TYPE_SWITCH, "baz", 'z', &baz, 'z', ADOPT_USAGE_CHOICE },
+		{ ADOPT_TYPE_SWITCH, "qux", 'q', &qux, 'q', ADOPT_USAGE_REQUIRED },
+		{ 0 },
+	};
+
+	char *args[] = { "-z", "-q" };
+
+	cl_assert_equal_i(ADOPT_STATUS_DONE, adopt_parse(&result, specs, args, 2, ADOPT_PARSE_DEFAULT));
+	cl_assert_equal_i('z', baz);
+	cl_assert_equal_i('q', qux);
+
+	cl_assert_equal_i(ADOPT_STATUS_MISSING_ARGUMENT, adopt_parse(&result, specs, &args[1], 1, ADOPT_PARSE_DEFAULT));
+	cl_assert_equal_p(&specs[0], result.spec);
+
+	cl_assert_equal_i(ADOPT_STATUS_MISSING_ARGUMENT, adopt_parse(&result, specs, args, 1, ADOPT_PARSE_DEFAULT));
+	cl_assert_equal_p(&specs[3], result.spec);
+}
+
 void test_adopt__stop(void)
 {
 	int foo = 0, bar = 0, help = 0, baz = 0;
@@ -1234,3 +1341,2509 @@ void test_adopt__stop(void)
 	cl_assert_equal_p(0,   bar);
 	cl_assert_equal_p(0,   baz);
 }
+
+void test_adopt__index_long_options(void)
+{
+	int foo = 0, bar = 1;
+	char *baz = NULL;
+
+	adopt_spec specs[] = {
+		{ ADOPT_TYPE_SWITCH, "foo", 0, &foo, 'f' },
+		{ ADOPT_TYPE_BOOL,   "bar", 0, &bar, 0 },
+		{ ADOPT_TYPE_VALUE,  "baz", 0, &baz, 0 },
+		{ ADOPT_TYPE_LITERAL },
+		{ 0 }
+	};
+
+	char *args[] = { "--foo", "--no-bar", "--baz=qux", "--foo=bar", "--", "--foo" };
+	adopt_expected expected[] = {
+		{ &specs[0], NULL },
+		{ &specs[1], NULL },
+		{ &specs[2], "qux" },
+		{ NULL, "--foo=bar" },
+		{ &specs[3], NULL },
+		{ NULL, "--foo" },
+	};
+
+	/* Parse --foo --no-bar --baz=qux --foo=bar -- --foo */
+	test_parse_indexed(specs, args, 6, expected, 6);
+	cl_assert_equal_i('f', foo);
+	cl_assert_equal_i(0, bar);
+	cl_assert_equal_s("qux", baz);
+}
+
+void test_adopt__index_long_values(void)
+{
+	char *foo = NULL, *bar = NULL;
+
+	adopt_spec specs[] = {
+		{ ADOPT_TYPE_VALUE, "foo", 0, &foo, 0, ADOPT_USAGE_VALUE_OPTIONAL },
+		{ ADOPT_TYPE_VALUE, "bar", 0, &bar, 0, ADOPT_USAGE_VALUE_OPTIONAL },
+		{ 0 }
+	};
+
+	char *args[] = { "--foo", "--bar", "--bar=", "--fo=x", "--foobar" };
+	adopt_expected expected[] = {
+		{ &specs[0], "--bar" },
+		{ &specs[1], NULL },
+		{ NULL, "--fo=x" },
+		{ NULL, "--foobar" },
+	};
+
+	/* Parse --foo --bar --bar= --fo=x --foobar */
+	test_parse_indexed(specs, args, 5, expected, 4);
+	cl_assert_equal_s("--bar", foo);
+	cl_assert_equal_s(NULL, bar);
+}
+
+void test_adopt__index_first_spec_wins(void)
+{
+	int foo = 0, nofoo = 0;
+
+	adopt_spec specs[] = {
+		{ ADOPT_TYPE_BOOL,   "foo",    0, &foo,   0 },
+		{ ADOPT_TYPE_SWITCH, "no-foo", 0, &nofoo, 'n' },
+		{ 0 }
+	};
+
+	char *args[] = { "--foo", "--no-foo" };
+	adopt_expected expected[] = {
+		{ &specs[0], NULL },
+		{ &specs[0], NULL },
+	};
+
+	/* The implicit negation precedes the later "no-foo" switch */
+	test_parse(specs, args, 2, expected, 2);
+	cl_assert_equal_i(0, foo);
+	cl_assert_equal_i(0, nofoo);
+
+	foo = 0;
+	test_parse_indexed(specs, args, 2, expected, 2);
+	cl_assert_equal_i(0, foo);
+	cl_assert_equal_i(0, nofoo);
+}
+
+void test_adopt__compressed_shorts_accumulate(void)
+{
+	int verbose = 0, zip = 0;
+	char *file = NULL, **argz = NULL;
+	adopt_opt result;
+
+	adopt_spec specs[] = {
+		{ ADOPT_TYPE_ACCUMULATOR, "verbose", 'v', &verbose, 0 },
+		{ ADOPT_TYPE_BOOL,        "zip",     'z', &zip,     0 },
+		{ ADOPT_TYPE_VALUE,       "file",    'f', &file,    0 },
+		{ ADOPT_TYPE_ARGS,        "argz",     0,  &argz,    0 },
+		{ 0 },
+	};
+
+	char *args[] = { "-vvzvf", "out.tar", "-vv", "in" };
+
+	cl_must_pass(adopt_parse(&result, specs, args, 4, ADOPT_PARSE_DEFAULT));
+
+	cl_assert_equal_i(ADOPT_STATUS_DONE, result.status);
+	cl_assert_equal_i(5, verbose);
+	cl_assert_equal_i(1, zip);
+	cl_assert_equal_s("out.tar", file);
+	cl_assert_equal_i(1, result.args_len);
+	cl_assert_equal_s("in", argz[0]);
+}
+
+void test_adopt__compressed_shorts_unknown(void)
+{
+	int foo = 0, bar = 0;
+	adopt_opt result;
+
+	adopt_spec specs[] = {
+		{ ADOPT_TYPE_ACCUMULATOR, "foo", 'f', &foo, 0 },
+		{ ADOPT_TYPE_ACCUMULATOR, "bar", 'b', &bar, 0 },
+		{ 0 },
+	};
+
+	char *args[] = { "-ffxb", "-b" };
+	adopt_expected expected[] = {
+		{ &specs[0], NULL },
+		{ &specs[0], NULL },
+		{ NULL, "-ffxb" },
+		{ &specs[1], NULL },
+	};
+
+	/* An unknown option abandons the remainder of its cluster */
+	test_parse(specs, args, 2, expected, 4);
+	cl_assert_equal_i(2, foo);
+	cl_assert_equal_i(1, bar);
+
+	foo = bar = 0;
+	cl_assert_equal_i(ADOPT_STATUS_UNKNOWN_OPTION,
+		adopt_parse(&result, specs, args, 2, ADOPT_PARSE_DEFAULT));
+	cl_assert_equal_s("-ffxb", result.arg);
+	cl_assert_equal_i(2, foo);
+	cl_assert_equal_i(0, bar);
+}
+
+void test_adopt__index_compressed_shorts(void)
+{
+	int foo = 0, baz = 0;
+	char *bar = NULL;
+
+	adopt_spec specs[] = {
+		{ ADOPT_TYPE_SWITCH, "foo", 'f', &foo, 'f' },
+		{ ADOPT_TYPE_BOOL,   "baz", 'z', &baz,  0  },
+		{ ADOPT_TYPE_VALUE,  "bar", 'b', &bar, 'b' },
+		{ 0 },
+	};
+
+	char *args[] = { "-fzbasdf", "-z", "-b", "value", "-q" };
+	adopt_expected expected[] = {
+		{ &specs[0], NULL },
+		{ &specs[1], NULL },
+		{ &specs[2], "asdf" },
+		{ &specs[1], NULL },
+		{ &specs[2], "value" },
+		{ NULL, "-q" },
+	};
+
+	test_parse_indexed(specs, args, 5, expected, 6);
+	cl_assert_equal_i('f', foo);
+	cl_assert_equal_i(1, baz);
+	cl_assert_equal_s("value", bar);
+}
+
+void test_adopt__index_positional(void)
+{
+	int foo = 0;
+	char *arg1 = NULL, *arg2 = NULL, **argz = NULL;
+	adopt_parser parser;
+	adopt_index *index;
+	adopt_opt opt;
+
+	adopt_spec specs[] = {
+		{ ADOPT_TYPE_ARG,    "arg1", 0,  &arg1, 0 },
+		{ ADOPT_TYPE_SWITCH, "foo", 'f', &foo, 'f' },
+		{ ADOPT_TYPE_ARG,    "arg2", 0,  &arg2, 0 },
+		{ ADOPT_TYPE_ARGS,   "argz", 0,  &argz, 0 },
+		{ 0 },
+	};
+
+	char *args[] = { "one", "-f", "two", "three", "-f", "four" };
+
+	cl_must_pass(adopt_spec_compile(&index, specs));
+	adopt_parser_init_index(&parser, index, args, 6, ADOPT_PARSE_DEFAULT);
+
+	cl_assert_equal_i(ADOPT_STATUS_OK, adopt_parser_next(&opt, &parser));
+	cl_assert_equal_p(&specs[0], opt.spec);
+	cl_assert_equal_i(ADOPT_STATUS_OK, adopt_parser_next(&opt, &parser));
+	cl_assert_equal_p(&specs[1], opt.spec);
+	cl_assert_equal_i(ADOPT_STATUS_OK, adopt_parser_next(&opt, &parser));
+	cl_assert_equal_p(&specs[2], opt.spec);
+
+	/* The remainder is handed to the args spec in one step */
+	cl_assert_equal_i(ADOPT_STATUS_OK, adopt_parser_next(&opt, &parser));
+	cl_assert_equal_p(&specs[3], opt.spec);
+	cl_assert_equal_i(3, opt.args_len);
+	cl_assert_equal_i(ADOPT_STATUS_DONE, adopt_parser_next(&opt, &parser));
+
+	cl_assert_equal_i('f', foo);
+	cl_assert_equal_s("one", arg1);
+	cl_assert_equal_s("two", arg2);
+	cl_assert_equal_s("three", argz[0]);
+	cl_assert_equal_s("-f", argz[1]);
+	cl_assert_equal_s("four", argz[2]);
+
+	adopt_index_free(index);
+}
+
+void test_adopt__index_positional_exhausted(void)
+{
+	char *arg1 = NULL;
+
+	adopt_spec specs[] = {
+		{ ADOPT_TYPE_LITERAL },
+		{ ADOPT_TYPE_ARG,    "arg1", 0,  &arg1, 0 },
+		{ 0 },
+	};
+
+	char *args[] = { "--", "-one", "two" };
+	adopt_expected expected[] = {
+		{ &specs[0], NULL },
+		{ &specs[1], NULL },
+		{ NULL, "two" },
+	};
+
+	test_parse_indexed(specs, args, 3, expected, 3);
+	cl_assert_equal_s("-one", arg1);
+}
+
+void test_adopt__parse_options_gnustyle_after_literal(void)
+{
+	int foo = 0, baz = 0;
+	char **argz = NULL;
+	char *args[] = { "-f", "--", "one", "-z", "two" };
+	adopt_opt result;
+
+	adopt_spec specs[] = {
+		{ ADOPT_TYPE_SWITCH, "foo", 'f', &foo,  'f' },
+		{ ADOPT_TYPE_SWITCH, "baz", 'z', &baz,  'z' },
+		{ ADOPT_TYPE_LITERAL },
+		{ ADOPT_TYPE_ARGS,   "argz", 0,  &argz,  0  },
+		{ 0 },
+	};
+
+	/* Arguments following a literal are not reordered */
+	cl_must_pass(adopt_parse(&result, specs, args, 5, ADOPT_PARSE_FORCE_GNU));
+
+	cl_assert_equal_i(ADOPT_STATUS_DONE, result.status);
+	cl_assert_equal_i(3, result.args_len);
+	cl_assert_equal_i('f', foo);
+	cl_assert_equal_i(0, baz);
+	cl_assert_equal_s("one", argz[0]);
+	cl_assert_equal_s("-z", argz[1]);
+	cl_assert_equal_s("two", argz[2]);
+}
+
+void test_adopt__parse_options_gnustyle_preserve(void)
+{
+	int foo = 0;
+	char *bar = NULL, **argz = NULL;
+	adopt_opt result;
+
+	adopt_spec specs[] = {
+		{ ADOPT_TYPE_SWITCH, "foo", 'f', &foo,  'f' },
+		{ ADOPT_TYPE_VALUE,  "bar",  0,  &bar,   0  },
+		{ ADOPT_TYPE_ARGS,   "argz", 0,  &argz,  0  },
+		{ 0 },
+	};
+
+	char *args[] = { "BRR", "-f", "one", "two", "--bar", "three", "four" };
+
+	cl_must_pass(adopt_parse(&result, specs, args, 7,
+		ADOPT_PARSE_FORCE_GNU | ADOPT_PARSE_PRESERVE_ARGS));
+
+	cl_assert_equal_i(ADOPT_STATUS_DONE, result.status);
+	cl_assert_equal_p(NULL, result.arg);
+	cl_assert_equal_p(NULL, result.value);
+	cl_assert_equal_i(4, result.args_len);
+
+	cl_assert_equal_i('f', foo);
+	cl_assert_equal_s("three", bar);
+	cl_assert_equal_p(NULL, argz);
+
+	cl_assert_equal_s("BRR", adopt_args_next(&result.args));
+	cl_assert_equal_s("one", adopt_args_next(&result.args));
+	cl_assert_equal_s("two", adopt_args_next(&result.args));
+	cl_assert_equal_s("four", adopt_args_next(&result.args));
+	cl_assert_equal_p(NULL, adopt_args_next(&result.args));
+
+	/* The arguments are left untouched */
+	cl_assert_equal_s("BRR", args[0]);
+	cl_assert_equal_s("-f", args[1]);
+	cl_assert_equal_s("one", args[2]);
+	cl_assert_equal_s("two", args[3]);
+	cl_assert_equal_s("--bar", args[4]);
+	cl_assert_equal_s("three", args[5]);
+	cl_assert_equal_s("four", args[6]);
+}
+
+void test_adopt__parse_options_gnustyle_preserve_clusters(void)
+{
+	int verbose = 0, stepwise;
+	char *file = NULL, *other = NULL;
+	adopt_parser parser;
+	adopt_opt opt;
+
+	adopt_spec specs[] = {
+		{ ADOPT_TYPE_ACCUMULATOR, "verbose", 'v', &verbose, 0 },
+		{ ADOPT_TYPE_ARG,         "file",     0,  &file,    0 },
+		{ ADOPT_TYPE_ARG,         "other",    0,  &other,   0 },
+		{ 0 },
+	};
+
+	char *args[] = { "file", "-vv", "other", "-v" };
+
+	adopt_parser_init(&parser, specs, args, 4,
+		ADOPT_PARSE_FORCE_GNU | ADOPT_PARSE_PRESERVE_ARGS);
+
+	while (adopt_parser_next(&opt, &parser))
+		cl_assert_equal_i(ADOPT_STATUS_OK, opt.status);
+
+	stepwise = verbose;
+	verbose = 0;
+
+	/* Clusters are applied once, not again when revisited for arguments */
+	cl_must_pass(adopt_parse(&opt, specs, args, 4,
+		ADOPT_PARSE_FORCE_GNU | ADOPT_PARSE_PRESERVE_ARGS));
+
+	cl_assert_equal_i(ADOPT_STATUS_DONE, opt.status);
+	cl_assert_equal_i(3, stepwise);
+	cl_assert_equal_i(stepwise, verbose);
+	cl_assert_equal_s("file", file);
+	cl_assert_equal_s("other", other);
+}
+
+static int sort_alloc_fails;
+
+/* Substituted for the allocation used to sort options GNU-style */
+void *test_sort_alloc(size_t len)
+{
+	return sort_alloc_fails ? NULL : malloc(len);
+}
+
+void test_adopt__parse_options_gnustyle_sort_fallback(void)
+{
+	int verbose = 0;
+	char *args[301], **argz = NULL;
+	adopt_tag tags[301];
+	adopt_parser parser;
+	adopt_opt opt;
+	size_t i;
+
+	adopt_spec specs[] = {
+		{ ADOPT_TYPE_ACCUMULATOR, "verbose", 'v', &verbose, 0 },
+		{ ADOPT_TYPE_ARGS,        "argz",     0,  &argz,    0 },
+		{ 0 },
+	};
+
+	args[0] = "first";
+
+	for (i = 1; i < 301; i++)
+		args[i] = (i % 2) ? "-v" : "bare";
+
+	/*
+	 * Without memory for all the options, they're sorted in several
+	 * passes, which mustn't rely on the (unmoved) tags.
+	 */
+	adopt_parser_init(&parser, specs, args, 301, ADOPT_PARSE_FORCE_GNU);
+	cl_must_pass(adopt_parser_classify(&parser, tags));
+
+	sort_alloc_fails = 1;
+
+	while (adopt_parser_next(&opt, &parser))
+		cl_assert_equal_i(ADOPT_STATUS_OK, opt.status);
+
+	sort_alloc_fails = 0;
+
+	cl_assert_equal_i(150, verbose);
+
+	for (i = 0; i < 150; i++)
+		cl_assert_equal_s("-v", args[i]);
+
+	cl_assert_equal_s("first", args[150]);
+	cl_assert_equal_p(&args[150], argz);
+
+	for (i = 151; i < 301; i++)
+		cl_assert_equal_s("bare", args[i]);
+
+	cl_assert_equal_i(151, opt.args_len);
+}
+
+void test_adopt__parse_options_gnustyle_preserve_literal(void)
+{
+	int foo = 0, baz = 0;
+	char *arg1 = NULL, *arg2 = NULL;
+
+	adopt_spec specs[] = {
+		{ ADOPT_TYPE_SWITCH, "foo", 'f', &foo,  'f' },
+		{ ADOPT_TYPE_SWITCH, "baz", 'z', &baz,  'z' },
+		{ ADOPT_TYPE_LITERAL },
+		{ ADOPT_TYPE_ARG,    "arg1", 0,  &arg1,  0  },
+		{ ADOPT_TYPE_ARG,    "arg2", 0,  &arg2,  0  },
+		{ 0 },
+	};
+
+	char *args[] = { "one", "-f", "--", "-z" };
+	adopt_expected expected[] = {
+		{ &specs[0], NULL },
+		{ &specs[3], NULL },
+		{ &specs[2], NULL },
+		{ &specs[4], NULL },
+	};
+	adopt_parser parser;
+
+	adopt_parser_init(&parser, specs, args, 4,
+		ADOPT_PARSE_FORCE_GNU | ADOPT_PARSE_PRESERVE_ARGS);
+	test_parser_expected(&parser, expected, 4);
+
+	cl_assert_equal_i('f', foo);
+	cl_assert_equal_i(0, baz);
+	cl_assert_equal_s("one", arg1);
+	cl_assert_equal_s("-z", arg2);
+	cl_assert_equal_s("one", args[0]);
+	cl_assert_equal_s("-f", args[1]);
+}
+
+void test_adopt__parse_args_iterator(void)
+{
+	int foo = 0;
+	char **argz = NULL;
+	adopt_opt result;
+
+	adopt_spec specs[] = {
+		{ ADOPT_TYPE_SWITCH, "foo", 'f', &foo,  'f' },
+		{ ADOPT_TYPE_ARGS,   "argz", 0,  &argz,  0  },
+		{ 0 },
+	};
+
+	char *args[] = { "-f", "one", "-f", "two" };
+
+	cl_must_pass(adopt_parse(&result, specs, args, 4, ADOPT_PARSE_DEFAULT));
+
+	cl_assert_equal_i(3, result.args_len);
+	cl_assert_equal_p(&args[1], argz);
+	cl_assert_equal_s("one", adopt_args_next(&result.args));
+	cl_assert_equal_s("-f", adopt_args_next(&result.args));
+	cl_assert_equal_s("two", adopt_args_next(&result.args));
+	cl_assert_equal_p(NULL, adopt_args_next(&result.args));
+}
+
+void test_adopt__parse_options_gnustyle_stop(void)
+{
+	int foo = 0, help = 0;
+	char **argz = NULL;
+	adopt_opt result;
+
+	adopt_spec specs[] = {
+		{ ADOPT_TYPE_SWITCH, "foo",  'f', &foo,  'f' },
+		{ ADOPT_TYPE_SWITCH, "help",  0,  &help, 'h', ADOPT_USAGE_STOP_PARSING },
+		{ ADOPT_TYPE_ARGS,   "argz",  0,  &argz,  0  },
+		{ 0 },
+	};
+
+	char *args[] = { "one", "two", "--help", "three", "-f", "four" };
+
+	cl_assert_equal_i(ADOPT_STATUS_DONE,
+		adopt_parse(&result, specs, args, 6, ADOPT_PARSE_FORCE_GNU));
+
+	cl_assert_equal_s("--help", result.arg);
+	cl_assert_equal_i('h', help);
+	cl_assert_equal_i(0, foo);
+	cl_assert_equal_p(NULL, argz);
+
+	/* Stopping early leaves the remaining arguments unsorted */
+	cl_assert_equal_s("one", args[0]);
+	cl_assert_equal_s("two", args[1]);
+	cl_assert_equal_s("--help", args[2]);
+	cl_assert_equal_s("three", args[3]);
+	cl_assert_equal_s("-f", args[4]);
+	cl_assert_equal_s("four", args[5]);
+}
+
+void test_adopt__parse_options_gnustyle_incremental(void)
+{
+	int foo = 0, baz = 0;
+	char *bar = NULL;
+	adopt_parser parser;
+	adopt_opt opt;
+
+	adopt_spec specs[] = {
+		{ ADOPT_TYPE_SWITCH, "foo", 'f', &foo,  'f' },
+		{ ADOPT_TYPE_SWITCH, "baz", 'z', &baz,  'z' },
+		{ ADOPT_TYPE_VALUE,  "bar",  0,  &bar,   0  },
+		{ ADOPT_TYPE_ARGS,   "argz", 0,  NULL,   0  },
+		{ 0 },
+	};
+
+	char *args[] = { "one", "-f", "two", "--bar", "three", "-z", "four" };
+
+	adopt_parser_init(&parser, specs, args, 7, ADOPT_PARSE_FORCE_GNU);
+
+	/* Options are parsed in place, as they're requested */
+	cl_assert_equal_i(ADOPT_STATUS_OK, adopt_parser_next(&opt, &parser));
+	cl_assert_equal_p(&specs[0], opt.spec);
+	cl_assert_equal_s("one", args[0]);
+	cl_assert_equal_s("-f", args[1]);
+
+	cl_assert_equal_i(ADOPT_STATUS_OK, adopt_parser_next(&opt, &parser));
+	cl_assert_equal_p(&specs[2], opt.spec);
+	cl_assert_equal_s("three", opt.value);
+
+	cl_assert_equal_i(ADOPT_STATUS_OK, adopt_parser_next(&opt, &parser));
+	cl_assert_equal_p(&specs[1], opt.spec);
+
+	/* Once they're exhausted, the arguments are sorted */
+	cl_assert_equal_i(ADOPT_STATUS_OK, adopt_parser_next(&opt, &parser));
+	cl_assert_equal_p(&specs[3], opt.spec);
+	cl_assert_equal_i(3, opt.args_len);
+
+	cl_assert_equal_s("-f", args[0]);
+	cl_assert_equal_s("--bar", args[1]);
+	cl_assert_equal_s("three", args[2]);
+	cl_assert_equal_s("-z", args[3]);
+	cl_assert_equal_s("one", args[4]);
+	cl_assert_equal_s("two", args[5]);
+	cl_assert_equal_s("four", args[6]);
+
+	cl_assert_equal_i(ADOPT_STATUS_DONE, adopt_parser_next(&opt, &parser));
+}
+
+void test_adopt__required_given_in_short_cluster(void)
+{
+	int foo = 0, bar = 0;
+	char *baz = NULL;
+	adopt_opt result;
+
+	adopt_spec specs[] = {
+		{ ADOPT_TYPE_SWITCH, "foo", 'f', &foo, 'f', ADOPT_USAGE_REQUIRED },
+		{ ADOPT_TYPE_SWITCH, "bar", 'b', &bar, 'b', ADOPT_USAGE_REQUIRED },
+		{ ADOPT_TYPE_ARG,    "baz",  0,  &baz,  0,  ADOPT_USAGE_REQUIRED },
+		{ 0 },
+	};
+
+	char *args[] = { "-fb", "one" };
+
+	cl_assert_equal_i(ADOPT_STATUS_DONE, adopt_parse(&result, specs, args, 2, ADOPT_PARSE_DEFAULT));
+	cl_assert_equal_i('f', foo);
+	cl_assert_equal_i('b', bar);
+	cl_assert_equal_s("one", baz);
+
+	cl_assert_equal_i(ADOPT_STATUS_MISSING_ARGUMENT, adopt_parse(&result, specs, args, 1, ADOPT_PARSE_DEFAULT));
+	cl_assert_equal_p(&specs[2], result.spec);
+}
+
+void test_adopt__required_many_args(void)
+{
+	int foo = 0;
+	char *bar = NULL, **args;
+	adopt_opt result;
+	size_t i, args_len = 100000;
+
+	adopt_spec specs[] = {
+		{ ADOPT_TYPE_SWITCH, "foo", 'f', &foo, 'f' },
+		{ ADOPT_TYPE_VALUE,  "bar", 'b', &bar,  0,  ADOPT_USAGE_REQUIRED },
+		{ 0 },
+	};
+
+	cl_assert((args = calloc(args_len, sizeof(char *))) != NULL);
+
+	for (i = 0; i < args_len; i++)
+		args[i] = "-f";
+
+	cl_assert_equal_i(ADOPT_STATUS_MISSING_ARGUMENT, adopt_parse(&result, specs, args, args_len, ADOPT_PARSE_DEFAULT));
+	cl_assert_equal_p(&specs[1], result.spec);
+
+	args[args_len - 1] = "--bar=baz";
+
+	cl_assert_equal_i(ADOPT_STATUS_DONE, adopt_parse(&result, specs, args, args_len, ADOPT_PARSE_DEFAULT));
+	cl_assert_equal_s("baz", bar);
+
+	free(args);
+}
+
+void test_adopt__required_many_specs(void)
+{
+	adopt_spec specs[301];
+	int values[300] = { 0 };
+	char *args[] = { "-a" };
+	adopt_opt result;
+	size_t i;
+
+	adopt_spec optional = { ADOPT_TYPE_BOOL, "bool", 0, NULL };
+	adopt_spec required = { ADOPT_TYPE_BOOL, "req", 'a', &values[299], 0, ADOPT_USAGE_REQUIRED };
+
+	/* More specs than fit in the parser's fixed bitset */
+	memset(specs, 0, sizeof(specs));
+
+	for (i = 0; i < 299; i++)
+		memcpy(&specs[i], &optional, sizeof(adopt_spec));
+
+	memcpy(&specs[299], &required, sizeof(adopt_spec));
+
+	cl_assert_equal_i(ADOPT_STATUS_DONE, adopt_parse(&result, specs, args, 1, ADOPT_PARSE_DEFAULT));
+	cl_assert_equal_i(1, values[299]);
+
+	cl_assert_equal_i(ADOPT_STATUS_MISSING_ARGUMENT, adopt_parse(&result, specs, args, 0, ADOPT_PARSE_DEFAULT));
+	cl_assert_equal_p(&specs[299], result.spec);
+}
+
+void test_adopt__parse_index_results(void)
+{
+	int foo = 0, bar = 0, verbose = 0;
+	char *baz = NULL, *arg = NULL, **argz = NULL;
+	adopt_value results[7];
+	adopt_index *index;
+	adopt_opt result;
+
+	adopt_spec specs[] = {
+		{ ADOPT_TYPE_SWITCH,      "foo",     'f', &foo,     'f' },
+		{ ADOPT_TYPE_BOOL,        "bar",     'b', &bar,      0  },
+		{ ADOPT_TYPE_ACCUMULATOR, "verbose", 'v', &verbose,  0  },
+		{ ADOPT_TYPE_VALUE,       "baz",     'z', &baz,      0  },
+		{ ADOPT_TYPE_ARG,         "arg",      0,  &arg,      0  },
+		{ ADOPT_TYPE_ARGS,        "argz",     0,  &argz,     0  },
+		{ 0 },
+	};
+
+	char *args[] = { "-fvv", "--no-bar", "--baz", "value", "one", "-v", "two", "three" };
+
+	cl_must_pass(adopt_spec_compile(&index, specs));
+	cl_assert_equal_i(6, adopt_index_len(index));
+
+	memset(results, 0, sizeof(results));
+	results[1].i = 1;
+
+	cl_assert_equal_i(ADOPT_STATUS_DONE, adopt_parse_index(&result, index, results, args, 8, ADOPT_PARSE_GNU));
+
+	cl_assert_equal_i('f', results[0].i);
+	cl_assert_equal_i(0, results[1].i);
+	cl_assert_equal_i(3, results[2].i);
+	cl_assert_equal_s("value", results[3].s);
+	cl_assert_equal_s("one", results[4].s);
+	cl_assert_equal_s("two", results[5].a[0]);
+	cl_assert_equal_s("three", results[5].a[1]);
+	cl_assert_equal_i(2, result.args_len);
+
+	/* The specs' own values are untouched */
+	cl_assert_equal_i(0, foo);
+	cl_assert_equal_i(0, bar);
+	cl_assert_equal_i(0, verbose);
+	cl_assert_equal_p(NULL, baz);
+	cl_assert_equal_p(NULL, arg);
+	cl_assert_equal_p(NULL, argz);
+
+	adopt_index_free(index);
+}
+
+void test_adopt__parse_index_without_results(void)
+{
+	int foo = 0;
+	char *bar = NULL;
+	adopt_index *index;
+	adopt_opt result;
+
+	adopt_spec specs[] = {
+		{ ADOPT_TYPE_SWITCH, "foo", 'f', &foo, 'f' },
+		{ ADOPT_TYPE_VALUE,  "bar", 'b', &bar,  0,  ADOPT_USAGE_REQUIRED },
+		{ 0 },
+	};
+
+	char *args[] = { "-f", "-bvalue" };
+
+	cl_must_pass(adopt_spec_compile(&index, specs));
+
+	cl_assert_equal_i(ADOPT_STATUS_MISSING_ARGUMENT, adopt_parse_index(&result, index, NULL, args, 1, ADOPT_PARSE_DEFAULT));
+	cl_assert_equal_p(&specs[1], result.spec);
+
+	cl_assert_equal_i(ADOPT_STATUS_DONE, adopt_parse_index(&result, index, NULL, args, 2, ADOPT_PARSE_DEFAULT));
+	cl_assert_equal_i('f', foo);
+	cl_assert_equal_s("value", bar);
+
+	adopt_index_free(index);
+}
+
+static void test_batch(unsigned int threads)
+{
+	adopt_index *index;
+	adopt_batch batch[1000];
+	adopt_value results[1000][4];
+	size_t i;
+
+	adopt_spec specs[] = {
+		{ ADOPT_TYPE_ACCUMULATOR, "verbose", 'v', NULL, 0 },
+		{ ADOPT_TYPE_VALUE,       "name",    'n', NULL, 0, ADOPT_USAGE_REQUIRED },
+		{ ADOPT_TYPE_ARG,         "file",     0,  NULL, 0 },
+		{ ADOPT_TYPE_ARGS,        "rest",     0,  NULL, 0 },
+		{ 0 },
+	};
+
+	char *good[] = { "-vv", "--name=value", "file", "one", "two" };
+	char *bad[] = { "-v", "file" };
+
+	cl_must_pass(adopt_spec_compile(&index, specs));
+
+	memset(batch, 0, sizeof(batch));
+	memset(results, 0, sizeof(results));
+
+	for (i = 0; i < 1000; i++) {
+		batch[i].args = (i % 10) ? good : bad;
+		batch[i].args_len = (i % 10) ? 5 : 2;
+		batch[i].results = results[i];
+	}
+
+	cl_assert_equal_i(100, adopt_parse_batch(index, batch, 1000, ADOPT_PARSE_DEFAULT, threads));
+
+	for (i = 0; i < 1000; i++) {
+		if (i % 10) {
+			cl_assert_equal_i(ADOPT_STATUS_DONE, batch[i].opt.status);
+			cl_assert_equal_i(2, results[i][0].i);
+			cl_assert_equal_s("value", results[i][1].s);
+			cl_assert_equal_s("file", results[i][2].s);
+			cl_assert_equal_p(&good[3], results[i][3].a);
+			cl_assert_equal_i(2, batch[i].opt.args_len);
+		} else {
+			cl_assert_equal_i(ADOPT_STATUS_MISSING_ARGUMENT, batch[i].opt.status);
+			cl_assert_equal_p(&specs[1], batch[i].opt.spec);
+			cl_assert_equal_i(1, results[i][0].i);
+		}
+	}
+
+	adopt_index_free(index);
+}
+
+void test_adopt__parse_batch(void)
+{
+	test_batch(0);
+}
+
+void test_adopt__parse_batch_threaded(void)
+{
+	test_batch(4);
+	test_batch(2000);
+}
+
+#define PARALLEL_ARGS 45000
+
+static void test_parallel(unsigned int flags, unsigned int threads)
+{
+	static char *serial[PARALLEL_ARGS], *parallel[PARALLEL_ARGS];
+	adopt_index *index;
+	adopt_value expected[5], actual[5];
+	adopt_opt expected_opt, actual_opt;
+	size_t i;
+
+	adopt_spec specs[] = {
+		{ ADOPT_TYPE_ACCUMULATOR, "verbose",   'v', NULL, 0 },
+		{ ADOPT_TYPE_VALUE,       "name",      'n', NULL, 0 },
+		{ ADOPT_TYPE_BOOL,        "recursive", 'r', NULL, 0 },
+		{ ADOPT_TYPE_ARG,         "file",       0,  NULL, 0 },
+		{ ADOPT_TYPE_ARGS,        "rest",       0,  NULL, 0 },
+		{ 0 },
+	};
+
+	char *cycle[] = { "-vv", "--name=first", "-r", "bare", "-n", "second", "--no-recursive", "-vrnthird", "bare" };
+
+	cl_must_pass(adopt_spec_compile(&index, specs));
+
+	for (i = 0; i < PARALLEL_ARGS; i++)
+		serial[i] = parallel[i] = cycle[i % 9];
+
+	memset(expected, 0, sizeof(expected));
+	memset(actual, 0, sizeof(actual));
+
+	cl_assert_equal_i(ADOPT_STATUS_DONE, adopt_parse_index(&expected_opt, index, expected, serial, PARALLEL_ARGS, flags));
+	cl_assert_equal_i(ADOPT_STATUS_DONE, adopt_parse_parallel(&actual_opt, index, actual, parallel, PARALLEL_ARGS, flags, threads));
+
+	/* The results (and reordered arguments) match the serial parse */
+	cl_assert_equal_i(expected[0].i, actual[0].i);
+	cl_assert_equal_p(expected[1].s, actual[1].s);
+	cl_assert_equal_i(expected[2].i, actual[2].i);
+	cl_assert_equal_p(expected[3].s, actual[3].s);
+	cl_assert_equal_i(expected[4].a ? expected[4].a - serial : -1,
+		actual[4].a ? actual[4].a - parallel : -1);
+	cl_assert_equal_i(expected_opt.args_len, actual_opt.args_len);
+	cl_assert(memcmp(serial, parallel, sizeof(serial)) == 0);
+
+	adopt_index_free(index);
+}
+
+void test_adopt__parse_parallel(void)
+{
+	test_parallel(ADOPT_PARSE_DEFAULT, 4);
+	test_parallel(ADOPT_PARSE_FORCE_GNU, 4);
+	test_parallel(ADOPT_PARSE_FORCE_GNU | ADOPT_PARSE_PRESERVE_ARGS, 4);
+	test_parallel(ADOPT_PARSE_FORCE_GNU, 1);
+}
+
+static void write_file(const char *path, const char *contents)
+{
+	FILE *fp;
+
+	cl_assert((fp = fopen(path, "wb")) != NULL);
+	cl_assert_equal_i(strlen(contents), fwrite(contents, 1, strlen(contents), fp));
+	cl_must_pass(fclose(fp));
+}
+
+void test_adopt__response_file(void)
+{
+	int foo = 0;
+	char *bar = NULL, **argz = NULL;
+	adopt_parser parser;
+	adopt_opt opt;
+
+	adopt_spec specs[] = {
+		{ ADOPT_TYPE_SWITCH, "foo",  'f', &foo,  'f' },
+		{ ADOPT_TYPE_VALUE,  "bar",  'b', &bar,   0  },
+		{ ADOPT_TYPE_ARGS,   "argz",  0,  &argz,  0  },
+		{ 0 },
+	};
+
+	char *args[] = { "-f", "@args.rsp", "last" };
+
+	write_file("args.rsp",
+		"--bar \"a b\"\n"
+		"  'c \"d\"'\te\\ f \"x\\\"y\\\\\" \"\" \\'z\\'\r\n"
+		"unterminated");
+
+	adopt_parser_init(&parser, specs, args, 3, ADOPT_PARSE_RESPONSE_FILES);
+
+	cl_assert_equal_i(ADOPT_STATUS_OK, adopt_parser_next(&opt, &parser));
+	cl_assert_equal_p(&specs[0], opt.spec);
+	cl_assert_equal_i(ADOPT_STATUS_OK, adopt_parser_next(&opt, &parser));
+	cl_assert_equal_p(&specs[1], opt.spec);
+	cl_assert_equal_s("a b", bar);
+
+	cl_assert_equal_i(ADOPT_STATUS_OK, adopt_parser_next(&opt, &parser));
+	cl_assert_equal_p(&specs[2], opt.spec);
+	cl_assert_equal_i(7, opt.args_len);
+	cl_assert_equal_s("c \"d\"", argz[0]);
+	cl_assert_equal_s("e f", argz[1]);
+	cl_assert_equal_s("x\"y\\", argz[2]);
+	cl_assert_equal_s("", argz[3]);
+	cl_assert_equal_s("'z'", argz[4]);
+	cl_assert_equal_s("unterminated", argz[5]);
+	cl_assert_equal_s("last", argz[6]);
+
+	cl_assert_equal_i(ADOPT_STATUS_DONE, adopt_parser_next(&opt, &parser));
+
+	adopt_parser_dispose(&parser);
+}
+
+void test_adopt__response_file_nested(void)
+{
+	adopt_response *response;
+	adopt_opt opt;
+	char **expanded;
+	size_t expanded_len;
+
+	char *args[] = { "zero", "@outer.rsp", "@", "four" };
+
+	write_file("outer.rsp", "one @inner.rsp\n@empty.rsp three\n");
+	write_file("inner.rsp", "two");
+	write_file("empty.rsp", "");
+
+	cl_assert_equal_i(ADOPT_STATUS_OK, adopt_response_expand(&response, &opt, args, 4));
+
+	expanded = adopt_response_args(&expanded_len, response);
+	cl_assert_equal_i(6, expanded_len);
+	cl_assert_equal_s("zero", expanded[0]);
+	cl_assert_equal_s("one", expanded[1]);
+	cl_assert_equal_s("two", expanded[2]);
+	cl_assert_equal_s("three", expanded[3]);
+	cl_assert_equal_s("@", expanded[4]);
+	cl_assert_equal_s("four", expanded[5]);
+
+	adopt_response_free(response);
+}
+
+void test_adopt__response_file_invalid(void)
+{
+	adopt_spec specs[] = {
+		{ ADOPT_TYPE_ARGS, "argz", 0, NULL, 0 },
+		{ 0 },
+	};
+
+	adopt_response *response;
+	adopt_parser parser;
+	adopt_opt opt;
+
+	char *missing[] = { "one", "@missing.rsp" };
+	char *cycle[] = { "@cycle1.rsp" };
+
+	write_file("cycle1.rsp", "one @cycle2.rsp");
+	write_file("cycle2.rsp", "two @cycle1.rsp");
+
+	cl_assert_equal_i(ADOPT_STATUS_INVALID_RESPONSE_FILE, adopt_response_expand(&response, &opt, missing, 2));
+	cl_assert_equal_s("@missing.rsp", opt.arg);
+	adopt_response_free(response);
+
+	/* A parser reports the failure when it is first advanced */
+	adopt_parser_init(&parser, specs, cycle, 1, ADOPT_PARSE_RESPONSE_FILES);
+	cl_assert_equal_i(ADOPT_STATUS_INVALID_RESPONSE_FILE, adopt_parser_next(&opt, &parser));
+	cl_assert_equal_s("@cycle1.rsp", opt.arg);
+
+	/* It's reported once; then parsing is finished */
+	cl_assert_equal_i(ADOPT_STATUS_DONE, adopt_parser_next(&opt, &parser));
+	cl_assert_equal_i(ADOPT_STATUS_DONE, adopt_parser_next(&opt, &parser));
+	adopt_parser_dispose(&parser);
+
+	/* As in a command string, an unterminated quote is invalid */
+	write_file("quote.rsp", "one \"two three");
+	write_file("nested.rsp", "zero @quote.rsp");
+
+	cycle[0] = "@nested.rsp";
+	cl_assert_equal_i(ADOPT_STATUS_INVALID_RESPONSE_FILE, adopt_response_expand(&response, &opt, cycle, 1));
+	cl_assert_equal_s("@quote.rsp", opt.arg);
+	adopt_response_free(response);
+}
+
+void test_adopt__response_file_unsupported_unchanged(void)
+{
+	int verbose = 0, x = 0;
+	char *args[] = { "-vvx", "@args.rsp" };
+	adopt_opt opt;
+
+	adopt_spec specs[] = {
+		{ ADOPT_TYPE_ACCUMULATOR, "verbose", 'v', &verbose, 0 },
+		{ ADOPT_TYPE_SWITCH,      "x",       'x', &x,       1 },
+		{ ADOPT_TYPE_ARGS,        "argz",     0,  NULL,     0 },
+		{ 0 },
+	};
+
+	/* Nothing is written when the flags fail parsing */
+	cl_assert_equal_i(ADOPT_STATUS_UNSUPPORTED_FLAGS,
+		adopt_parse(&opt, specs, args, 2, ADOPT_PARSE_RESPONSE_FILES));
+	cl_assert_equal_i(0, verbose);
+	cl_assert_equal_i(0, x);
+}
+
+void test_adopt__response_file_unsupported(void)
+{
+	adopt_spec specs[] = {
+		{ ADOPT_TYPE_ARGS, "argz", 0, NULL, 0 },
+		{ 0 },
+	};
+
+	adopt_index *index;
+	adopt_batch batch[2];
+	adopt_opt opt;
+	char *args[] = { "@args.rsp" };
+
+	write_file("args.rsp", "one two");
+
+	/* Parsing in one call can't keep the response files mapped */
+	cl_assert_equal_i(ADOPT_STATUS_UNSUPPORTED_FLAGS,
+		adopt_parse(&opt, specs, args, 1, ADOPT_PARSE_RESPONSE_FILES));
+
+	cl_must_pass(adopt_spec_compile(&index, specs));
+
+	cl_assert_equal_i(ADOPT_STATUS_UNSUPPORTED_FLAGS,
+		adopt_parse_index(&opt, index, NULL, args, 1, ADOPT_PARSE_RESPONSE_FILES));
+
+	memset(batch, 0, sizeof(batch));
+	batch[0].args = batch[1].args = args;
+	batch[0].args_len = batch[1].args_len = 1;
+
+	cl_assert_equal_i(2, adopt_parse_batch(index, batch, 2, ADOPT_PARSE_RESPONSE_FILES, 0));
+	cl_assert_equal_i(ADOPT_STATUS_UNSUPPORTED_FLAGS, batch[1].opt.status);
+
+	adopt_index_free(index);
+}
+
+void test_adopt__source_fd(void)
+{
+	int verbose = 0;
+	char *name = NULL, *arg = NULL, **argz = NULL, expected[16];
+	adopt_fd_source source;
+	adopt_parser parser;
+	adopt_opt opt;
+	FILE *fp;
+	size_t i;
+
+	adopt_spec specs[] = {
+		{ ADOPT_TYPE_ACCUMULATOR, "verbose", 'v', &verbose, 0 },
+		{ ADOPT_TYPE_VALUE,       "name",    'n', &name,    0 },
+		{ ADOPT_TYPE_ARG,         "arg",      0,  &arg,     0 },
+		{ ADOPT_TYPE_ARGS,        "argz",     0,  &argz,    0 },
+		{ 0 },
+	};
+
+	cl_assert((fp = fopen("args", "wb")) != NULL);
+	cl_assert(fwrite("-vv\0--name\0value\0first", 1, 22, fp) == 22);
+
+	for (i = 0; i < 1000; i++)
+		cl_assert(fprintf(fp, "%cpath%d", '\0', (int)i) > 0);
+
+	cl_must_pass(fclose(fp));
+
+	/* A small buffer, so that it's reused many times */
+	cl_assert((fp = fopen("args", "rb")) != NULL);
+	cl_must_pass(adopt_fd_source_init(&source, fileno(fp), '\0', 10));
+
+	adopt_parser_init_source(&parser, specs, &source.parent, ADOPT_PARSE_DEFAULT);
+
+	cl_assert_equal_i(ADOPT_STATUS_OK, adopt_parser_next(&opt, &parser));
+	cl_assert_equal_p(&specs[0], opt.spec);
+	cl_assert_equal_i(ADOPT_STATUS_OK, adopt_parser_next(&opt, &parser));
+	cl_assert_equal_p(&specs[0], opt.spec);
+	cl_assert_equal_i(2, verbose);
+
+	cl_assert_equal_i(ADOPT_STATUS_OK, adopt_parser_next(&opt, &parser));
+	cl_assert_equal_p(&specs[1], opt.spec);
+	cl_assert_equal_s("--name", opt.arg);
+	cl_assert_equal_s("value", opt.value);
+
+	cl_assert_equal_i(ADOPT_STATUS_OK, adopt_parser_next(&opt, &parser));
+	cl_assert_equal_p(&specs[2], opt.spec);
+	cl_assert_equal_s("first", arg);
+
+	/* Each of the remaining arguments is returned as it's read */
+	for (i = 0; i < 1000; i++) {
+		sprintf(expected, "path%d", (int)i);
+
+		cl_assert_equal_i(ADOPT_STATUS_OK, adopt_parser_next(&opt, &parser));
+		cl_assert_equal_p(&specs[3], opt.spec);
+		cl_assert_equal_s(expected, opt.arg);
+		cl_assert_equal_i(i + 1, opt.args_len);
+	}
+
+	cl_assert_equal_i(ADOPT_STATUS_DONE, adopt_parser_next(&opt, &parser));
+	cl_assert_equal_p(NULL, argz);
+
+	adopt_fd_source_dispose(&source);
+	cl_must_pass(fclose(fp));
+}
+
+void test_adopt__source_fd_too_long(void)
+{
+	int foo = 0;
+	adopt_fd_source source;
+	adopt_parser parser;
+	adopt_opt opt;
+	FILE *fp;
+
+	adopt_spec specs[] = {
+		{ ADOPT_TYPE_SWITCH,  "foo", 'f', &foo, 'f' },
+		{ ADOPT_TYPE_LITERAL },
+		{ ADOPT_TYPE_ARGS,    "argz", 0,  NULL,  0  },
+		{ 0 },
+	};
+
+	write_file("lines", "-f\n--\n-one\nthe second line is too long\n");
+
+	cl_assert((fp = fopen("lines", "rb")) != NULL);
+	cl_must_pass(adopt_fd_source_init(&source, fileno(fp), '\n', 16));
+
+	adopt_parser_init_source(&parser, specs, &source.parent, ADOPT_PARSE_DEFAULT);
+
+	cl_assert_equal_i(ADOPT_STATUS_OK, adopt_parser_next(&opt, &parser));
+	cl_assert_equal_i('f', foo);
+
+	/* Following a literal, options are arguments */
+	cl_assert_equal_i(ADOPT_STATUS_OK, adopt_parser_next(&opt, &parser));
+	cl_assert_equal_p(&specs[1], opt.spec);
+	cl_assert_equal_i(ADOPT_STATUS_OK, adopt_parser_next(&opt, &parser));
+	cl_assert_equal_p(&specs[2], opt.spec);
+	cl_assert_equal_s("-one", opt.arg);
+
+	cl_assert_equal_i(ADOPT_STATUS_SOURCE_ERROR, adopt_parser_next(&opt, &parser));
+
+	adopt_fd_source_dispose(&source);
+	cl_must_pass(fclose(fp));
+}
+
+void test_adopt__source_fd_max_len(void)
+{
+	adopt_fd_source source;
+	char *arg;
+	FILE *fp;
+
+	/* An argument of exactly the maximum length is read */
+	write_file("lines", "12345678\n123456789\n");
+
+	cl_assert((fp = fopen("lines", "rb")) != NULL);
+	cl_must_pass(adopt_fd_source_init(&source, fileno(fp), '\n', 8));
+
+	cl_assert_equal_i(1, source.parent.next(&arg, &source.parent));
+	cl_assert_equal_s("12345678", arg);
+	cl_assert_equal_i(-1, source.parent.next(&arg, &source.parent));
+
+	adopt_fd_source_dispose(&source);
+	cl_must_pass(fclose(fp));
+
+	/* Including the last, without a delimiter */
+	write_file("lines", "12345678");
+
+	cl_assert((fp = fopen("lines", "rb")) != NULL);
+	cl_must_pass(adopt_fd_source_init(&source, fileno(fp), '\n', 8));
+
+	cl_assert_equal_i(1, source.parent.next(&arg, &source.parent));
+	cl_assert_equal_s("12345678", arg);
+	cl_assert_equal_i(0, source.parent.next(&arg, &source.parent));
+
+	adopt_fd_source_dispose(&source);
+	cl_must_pass(fclose(fp));
+
+	write_file("lines", "1\n123456789");
+
+	cl_assert((fp = fopen("lines", "rb")) != NULL);
+	cl_must_pass(adopt_fd_source_init(&source, fileno(fp), '\n', 8));
+
+	cl_assert_equal_i(1, source.parent.next(&arg, &source.parent));
+	cl_assert_equal_s("1", arg);
+	cl_assert_equal_i(-1, source.parent.next(&arg, &source.parent));
+
+	adopt_fd_source_dispose(&source);
+	cl_must_pass(fclose(fp));
+}
+
+void test_adopt__source_fd_values(void)
+{
+	adopt_values includes = { 0 };
+	adopt_list list = { 0 };
+	adopt_fd_source source;
+	adopt_parser parser;
+	adopt_arena arena;
+	adopt_opt opt;
+	char buf[512];
+	FILE *fp;
+
+	adopt_spec specs[] = {
+		{ ADOPT_TYPE_VALUES, "include", 'I', &includes, 0 },
+		{ ADOPT_TYPE_LIST,   "list",    'l', &list,     0 },
+		{ 0 },
+	};
+
+	write_file("lines", "-I\none\n-I\ntwo\n-lthree,four\n-I\nfive\n");
+
+	/* The source's buffer is reused, so the values can't be kept */
+	cl_assert((fp = fopen("lines", "rb")) != NULL);
+	cl_must_pass(adopt_fd_source_init(&source, fileno(fp), '\n', 16));
+
+	adopt_parser_init_source(&parser, specs, &source.parent, ADOPT_PARSE_DEFAULT);
+	cl_assert_equal_i(ADOPT_STATUS_UNSUPPORTED_FLAGS, adopt_parser_next(&opt, &parser));
+	cl_assert_equal_i(0, includes.len);
+
+	adopt_fd_source_dispose(&source);
+	cl_must_pass(fclose(fp));
+
+	/* Copied into an arena, they're collected */
+	cl_assert((fp = fopen("lines", "rb")) != NULL);
+	cl_must_pass(adopt_fd_source_init(&source, fileno(fp), '\n', 16));
+
+	adopt_arena_init(&arena, buf, sizeof(buf));
+	adopt_parser_init_source(&parser, specs, &source.parent, ADOPT_PARSE_COPY_VALUES);
+	adopt_parser_set_arena(&parser, &arena);
+
+	while (adopt_parser_next(&opt, &parser))
+		cl_assert_equal_i(ADOPT_STATUS_OK, opt.status);
+
+	cl_assert_equal_i(3, includes.len);
+	cl_assert_equal_s("one", includes.values[0]);
+	cl_assert_equal_s("two", includes.values[1]);
+	cl_assert_equal_s("five", includes.values[2]);
+	cl_assert_equal_p(NULL, includes.values[3]);
+
+	cl_assert_equal_i(2, list.len);
+	cl_assert_equal_i(5, list.items[0].len);
+	cl_assert(memcmp(list.items[0].ptr, "three", 5) == 0);
+	cl_assert(memcmp(list.items[1].ptr, "four", 4) == 0);
+
+	adopt_fd_source_dispose(&source);
+	cl_must_pass(fclose(fp));
+}
+
+void test_adopt__source_unsupported_flags(void)
+{
+	int foo = 0;
+	adopt_fd_source source;
+	adopt_parser parser;
+	adopt_opt opt;
+	FILE *fp;
+
+	adopt_spec specs[] = {
+		{ ADOPT_TYPE_SWITCH, "foo", 'f', &foo, 'f' },
+		{ 0 },
+	};
+
+	char buf[] = "-f";
+	adopt_slice slices[] = { { buf, 2 } };
+
+	write_file("lines", "-f\n");
+
+	/* Flags that can't be honoured fail, rather than being ignored */
+	cl_assert((fp = fopen("lines", "rb")) != NULL);
+	cl_must_pass(adopt_fd_source_init(&source, fileno(fp), '\n', 16));
+
+	adopt_parser_init_source(&parser, specs, &source.parent, ADOPT_PARSE_FORCE_GNU);
+	cl_assert_equal_i(ADOPT_STATUS_UNSUPPORTED_FLAGS, adopt_parser_next(&opt, &parser));
+	cl_assert_equal_i(ADOPT_STATUS_DONE, adopt_parser_next(&opt, &parser));
+
+	adopt_fd_source_dispose(&source);
+	cl_must_pass(fclose(fp));
+
+	adopt_parser_init_slices(&parser, specs, slices, 1, ADOPT_PARSE_RESPONSE_FILES);
+	cl_assert_equal_i(ADOPT_STATUS_UNSUPPORTED_FLAGS, adopt_parser_next(&opt, &parser));
+	cl_assert_equal_i(ADOPT_STATUS_DONE, adopt_parser_next(&opt, &parser));
+
+	adopt_parser_init_slices(&parser, specs, slices, 1, ADOPT_PARSE_GNU);
+	cl_assert_equal_i(ADOPT_STATUS_UNSUPPORTED_FLAGS, adopt_parser_next(&opt, &parser));
+
+	cl_assert_equal_i(0, foo);
+}
+
+void test_adopt__tokenize(void)
+{
+	char str[] = "  deploy\t--env=prod -f \"my file\" 'a \"b\"'c\\ d \"\\$x \\y\" '' \\\n\"\\\\\" e\\\nf\n";
+	char *args[16];
+	size_t args_len;
+
+	cl_must_pass(adopt_tokenize(args, &args_len, 16, str));
+	cl_assert_equal_i(9, args_len);
+	cl_assert_equal_s("deploy", args[0]);
+	cl_assert_equal_s("--env=prod", args[1]);
+	cl_assert_equal_s("-f", args[2]);
+	cl_assert_equal_s("my file", args[3]);
+	cl_assert_equal_s("a \"b\"c d", args[4]);
+	cl_assert_equal_s("$x \\y", args[5]);
+	cl_assert_equal_s("", args[6]);
+	cl_assert_equal_s("\\", args[7]);
+	cl_assert_equal_s("ef", args[8]);
+}
+
+void test_adopt__tokenize_continuation(void)
+{
+	char between[] = "foo \\\n bar";
+	char trailing[] = "foo \\\n";
+	char joined[] = "\\\nfoo\\\nbar \\\n\\\n\tbaz";
+	char *args[4];
+	size_t args_len;
+
+	/* A joined line between arguments is blank, not an empty argument */
+	cl_must_pass(adopt_tokenize(args, &args_len, 4, between));
+	cl_assert_equal_i(2, args_len);
+	cl_assert_equal_s("foo", args[0]);
+	cl_assert_equal_s("bar", args[1]);
+
+	cl_must_pass(adopt_tokenize(args, &args_len, 4, trailing));
+	cl_assert_equal_i(1, args_len);
+	cl_assert_equal_s("foo", args[0]);
+
+	cl_must_pass(adopt_tokenize(args, &args_len, 4, joined));
+	cl_assert_equal_i(2, args_len);
+	cl_assert_equal_s("foobar", args[0]);
+	cl_assert_equal_s("baz", args[1]);
+}
+
+void test_adopt__tokenize_invalid(void)
+{
+	char unterminated[] = "one \"two three";
+	char escape[] = "one two\\";
+	char many[] = "one two three";
+	char *args[2];
+	size_t args_len;
+
+	cl_must_fail(adopt_tokenize(args, &args_len, 2, unterminated));
+	cl_must_fail(adopt_tokenize(args, &args_len, 2, escape));
+	cl_must_fail(adopt_tokenize(args, &args_len, 2, many));
+}
+
+void test_adopt__parse_string(void)
+{
+	int force = 0;
+	char *env = NULL, *target = NULL;
+	char *args[8];
+	adopt_opt opt;
+
+	adopt_spec specs[] = {
+		{ ADOPT_TYPE_SWITCH, "force",  'f', &force,  1 },
+		{ ADOPT_TYPE_VALUE,  "env",    'e', &env,    0 },
+		{ ADOPT_TYPE_ARG,    "target",  0,  &target, 0, ADOPT_USAGE_REQUIRED },
+		{ 0 },
+	};
+
+	char str[] = "--env=prod -f \"my file\"";
+	char missing[] = "--env 'staging'";
+	char invalid[] = "--env 'staging";
+
+	cl_assert_equal_i(ADOPT_STATUS_DONE, adopt_parse_string(&opt, specs, str, args, 8, ADOPT_PARSE_DEFAULT));
+	cl_assert_equal_s("prod", env);
+	cl_assert_equal_i(1, force);
+	cl_assert_equal_s("my file", target);
+
+	cl_assert_equal_i(ADOPT_STATUS_MISSING_ARGUMENT, adopt_parse_string(&opt, specs, missing, args, 8, ADOPT_PARSE_DEFAULT));
+	cl_assert_equal_s("staging", env);
+
+	cl_assert_equal_i(ADOPT_STATUS_INVALID_STRING, adopt_parse_string(&opt, specs, invalid, args, 8, ADOPT_PARSE_DEFAULT));
+}
+
+void test_adopt__parse_slices(void)
+{
+	int force = 0;
+	adopt_slice name = { 0 }, arg = { 0 }, *argz = NULL;
+	adopt_parser parser;
+	adopt_opt opt;
+
+	adopt_spec specs[] = {
+		{ ADOPT_TYPE_SWITCH, "force", 'f', &force, 1 },
+		{ ADOPT_TYPE_VALUE,  "name",  'n', &name,  0 },
+		{ ADOPT_TYPE_ARG,    "arg",    0,  &arg,   0 },
+		{ ADOPT_TYPE_ARGS,   "argz",   0,  &argz,  0 },
+		{ 0 },
+	};
+
+	/* None of the arguments are NUL-terminated */
+	char buf[] = "--name=value-f-nbarfirst--namesecondthird";
+	adopt_slice args[] = {
+		{ &buf[0],  12 },
+		{ &buf[12], 2 },
+		{ &buf[14], 5 },
+		{ &buf[19], 5 },
+		{ &buf[24], 6 },
+		{ &buf[30], 6 },
+		{ &buf[36], 5 },
+	};
+
+	adopt_parser_init_slices(&parser, specs, args, 7, ADOPT_PARSE_DEFAULT);
+
+	cl_assert_equal_i(ADOPT_STATUS_OK, adopt_parser_next(&opt, &parser));
+	cl_assert_equal_p(&specs[1], opt.spec);
+	cl_assert_equal_p(&buf[0], opt.arg);
+	cl_assert_equal_i(12, opt.arg_len);
+	cl_assert_equal_p(&buf[7], opt.value);
+	cl_assert_equal_i(5, opt.value_len);
+
+	cl_assert_equal_i(ADOPT_STATUS_OK, adopt_parser_next(&opt, &parser));
+	cl_assert_equal_p(&specs[0], opt.spec);
+	cl_assert_equal_i(1, force);
+
+	cl_assert_equal_i(ADOPT_STATUS_OK, adopt_parser_next(&opt, &parser));
+	cl_assert_equal_p(&specs[1], opt.spec);
+	cl_assert_equal_p(&buf[16], name.ptr);
+	cl_assert_equal_i(3, name.len);
+
+	cl_assert_equal_i(ADOPT_STATUS_OK, adopt_parser_next(&opt, &parser));
+	cl_assert_equal_p(&specs[2], opt.spec);
+	cl_assert_equal_p(&buf[19], arg.ptr);
+	cl_assert_equal_i(5, arg.len);
+
+	/* A value given in the next argument */
+	cl_assert_equal_i(ADOPT_STATUS_OK, adopt_parser_next(&opt, &parser));
+	cl_assert_equal_p(&specs[1], opt.spec);
+	cl_assert_equal_p(&buf[30], name.ptr);
+	cl_assert_equal_i(6, name.len);
+
+	cl_assert_equal_i(ADOPT_STATUS_OK, adopt_parser_next(&opt, &parser));
+	cl_assert_equal_p(&specs[3], opt.spec);
+	cl_assert_equal_p(&args[6], argz);
+	cl_assert_equal_i(1, opt.args_len);
+
+	cl_assert_equal_i(ADOPT_STATUS_DONE, adopt_parser_next(&opt, &parser));
+}
+
+void test_adopt__parse_slices_unknown(void)
+{
+	int force = 0;
+	adopt_parser parser;
+	adopt_opt opt;
+
+	adopt_spec specs[] = {
+		{ ADOPT_TYPE_SWITCH, "force", 'f', &force, 1 },
+		{ 0 },
+	};
+
+	/* A prefix of a known option isn't matched */
+	char buf[] = "--forcefully";
+	adopt_slice args[] = { { buf, 9 }, { buf, 7 }, { buf, 1 } };
+
+	adopt_parser_init_slices(&parser, specs, args, 3, ADOPT_PARSE_DEFAULT);
+
+	cl_assert_equal_i(ADOPT_STATUS_UNKNOWN_OPTION, adopt_parser_next(&opt, &parser));
+	cl_assert_equal_p(NULL, opt.spec);
+	cl_assert_equal_p(buf, opt.arg);
+	cl_assert_equal_i(9, opt.arg_len);
+
+	cl_assert_equal_i(ADOPT_STATUS_OK, adopt_parser_next(&opt, &parser));
+	cl_assert_equal_p(&specs[0], opt.spec);
+	cl_assert_equal_i(1, force);
+
+	/* A lone "-" isn't an option */
+	cl_assert_equal_i(ADOPT_STATUS_UNKNOWN_OPTION, adopt_parser_next(&opt, &parser));
+	cl_assert_equal_i(1, opt.arg_len);
+}
+
+void test_adopt__parse_slices_nul(void)
+{
+	int force = 0, quiet = 0;
+	adopt_index *index;
+	adopt_parser parser;
+	adopt_opt opt;
+
+	adopt_spec specs[] = {
+		{ ADOPT_TYPE_BOOL,   "quiet",  0,  &quiet, 0 },
+		{ ADOPT_TYPE_SWITCH, "force", 'f', &force, 1 },
+		{ 0 },
+	};
+
+	/* An embedded NUL doesn't name an option without an alias */
+	char buf[] = "-\0-f\0";
+	adopt_slice args[] = { { buf, 2 }, { &buf[2], 3 } };
+
+	adopt_parser_init_slices(&parser, specs, args, 2, ADOPT_PARSE_DEFAULT);
+
+	cl_assert_equal_i(ADOPT_STATUS_UNKNOWN_OPTION, adopt_parser_next(&opt, &parser));
+	cl_assert_equal_p(NULL, opt.spec);
+	cl_assert_equal_i(ADOPT_STATUS_OK, adopt_parser_next(&opt, &parser));
+	cl_assert_equal_i(1, force);
+	cl_assert_equal_i(ADOPT_STATUS_UNKNOWN_OPTION, adopt_parser_next(&opt, &parser));
+	cl_assert_equal_i(0, quiet);
+
+	cl_must_pass(adopt_spec_compile(&index, specs));
+
+	/* Nor in the index's alias table */
+	adopt_parser_init_slices(&parser, specs, args, 1, ADOPT_PARSE_DEFAULT);
+	parser.index = index;
+
+	cl_assert_equal_i(ADOPT_STATUS_UNKNOWN_OPTION, adopt_parser_next(&opt, &parser));
+	cl_assert_equal_i(0, quiet);
+
+	adopt_index_free(index);
+}
+
+void test_adopt__classify(void)
+{
+	char longopt[128], longval[128];
+	char *args[] = { "bare", "-", "-vf", "--", "--name", "--name=value", "", longopt, longval };
+	adopt_tag tags[9];
+	adopt_slice slices[1] = { { "-v", 2 } };
+	adopt_spec specs[] = { { 0 } };
+	adopt_parser parser;
+
+	/* Names that span several vectors */
+	memset(longopt, 'a', 127);
+	longopt[0] = longopt[1] = '-';
+	longopt[127] = '\0';
+	memcpy(longval, longopt, 128);
+	longval[100] = '=';
+
+	adopt_parser_init(&parser, specs, args, 9, ADOPT_PARSE_DEFAULT);
+	cl_must_pass(adopt_parser_classify(&parser, tags));
+
+	cl_assert_equal_i(ADOPT_TAG_BARE, ADOPT_TAG_KIND(tags[0]));
+	cl_assert_equal_i(ADOPT_TAG_SHORT, ADOPT_TAG_KIND(tags[1]));
+	cl_assert_equal_i(ADOPT_TAG_SHORT, ADOPT_TAG_KIND(tags[2]));
+	cl_assert_equal_i(ADOPT_TAG_LITERAL, ADOPT_TAG_KIND(tags[3]));
+	cl_assert_equal_i(ADOPT_TAG_LONG, ADOPT_TAG_KIND(tags[4]));
+	cl_assert_equal_i(ADOPT_TAG_LONG, ADOPT_TAG_KIND(tags[5]));
+	cl_assert_equal_i(ADOPT_TAG_BARE, ADOPT_TAG_KIND(tags[6]));
+	cl_assert_equal_i(ADOPT_TAG_LONG, ADOPT_TAG_KIND(tags[7]));
+	cl_assert_equal_i(ADOPT_TAG_LONG, ADOPT_TAG_KIND(tags[8]));
+
+	/* Only arrays of arguments can be classified */
+	adopt_parser_init_slices(&parser, specs, slices, 1, ADOPT_PARSE_DEFAULT);
+	cl_must_fail(adopt_parser_classify(&parser, tags));
+}
+
+void test_adopt__parse_classified(void)
+{
+	int verbose = 0, force = 0;
+	char *name = NULL, *value = NULL, **files = NULL;
+	char longopt[128];
+	char *args[] = { "one", "--name=foo", "-vf", "two", "--value", "bar", "-v", "three", longopt };
+	adopt_tag tags[9];
+	adopt_parser parser;
+	adopt_opt opt;
+
+	adopt_spec specs[] = {
+		{ ADOPT_TYPE_ACCUMULATOR, "verbose", 'v', &verbose, 0 },
+		{ ADOPT_TYPE_SWITCH,      "force",   'f', &force,   1 },
+		{ ADOPT_TYPE_VALUE,       "name",    'n', &name,    0 },
+		{ ADOPT_TYPE_VALUE,       "value",    0,  &value,   0 },
+		{ ADOPT_TYPE_ARGS,        "files",    0,  &files,   0 },
+		{ 0 },
+	};
+
+	/* A long option name, followed by an '=' and a value */
+	memset(longopt, 'a', 127);
+	memcpy(longopt, "--value=", 8);
+	longopt[127] = '\0';
+
+	adopt_parser_init(&parser, specs, args, 9, ADOPT_PARSE_FORCE_GNU);
+	cl_must_pass(adopt_parser_classify(&parser, tags));
+
+	while (adopt_parser_next(&opt, &parser))
+		cl_assert_equal_i(ADOPT_STATUS_OK, opt.status);
+
+	cl_assert_equal_i(3, opt.args_len);
+	cl_assert_equal_i(2, verbose);
+	cl_assert_equal_i(1, force);
+	cl_assert_equal_s("foo", name);
+	cl_assert_equal_p(&longopt[8], value);
+
+	/* Options are sorted ahead of the bare arguments */
+	cl_assert_equal_s("one", files[0]);
+	cl_assert_equal_s("two", files[1]);
+	cl_assert_equal_s("three", files[2]);
+}
+
+void test_adopt__values(void)
+{
+	adopt_values includes = { 0 };
+	char *define = NULL, **rest = NULL;
+	char *args[] = { "-Ione", "--include=two", "-d", "foo", "--include", "three", "-I", "four", "--", "-Ifive" };
+	adopt_parser parser;
+	adopt_opt opt;
+
+	adopt_spec specs[] = {
+		{ ADOPT_TYPE_VALUES, "include", 'I', &includes, 0 },
+		{ ADOPT_TYPE_VALUE,  "define",  'd', &define,   0 },
+		{ ADOPT_TYPE_LITERAL },
+		{ ADOPT_TYPE_ARGS,   "rest",     0,  &rest,     0 },
+		{ 0 },
+	};
+
+	adopt_parser_init(&parser, specs, args, 10, ADOPT_PARSE_DEFAULT);
+
+	while (adopt_parser_next(&opt, &parser)) {
+		if (opt.status != ADOPT_STATUS_OK)
+			break;
+	}
+
+	cl_assert_equal_i(ADOPT_STATUS_DONE, opt.status);
+	cl_assert_equal_s("foo", define);
+	cl_assert_equal_s("-Ifive", rest[0]);
+
+	/* Values are allocated once, sized by counting the occurrences */
+	cl_assert_equal_i(4, includes.len);
+	cl_assert_equal_i(4, includes.alloc);
+	cl_assert_equal_s("one", includes.values[0]);
+	cl_assert_equal_s("two", includes.values[1]);
+	cl_assert_equal_s("three", includes.values[2]);
+	cl_assert_equal_s("four", includes.values[3]);
+	cl_assert_equal_p(NULL, includes.values[4]);
+
+	free(includes.values);
+}
+
+void test_adopt__values_arena(void)
+{
+	adopt_values includes = { 0 };
+	char *args[] = { "-Ione", "two", "--include=three", "-Ifour" };
+	char *buf[4];
+	adopt_arena arena;
+	adopt_parser parser;
+	adopt_opt opt;
+
+	adopt_spec specs[] = {
+		{ ADOPT_TYPE_VALUES, "include", 'I', &includes, 0 },
+		{ ADOPT_TYPE_ARG,    "file",     0,  NULL,      0 },
+		{ 0 },
+	};
+
+	adopt_arena_init(&arena, buf, sizeof(buf));
+	adopt_parser_init(&parser, specs, args, 4, ADOPT_PARSE_DEFAULT);
+	adopt_parser_set_arena(&parser, &arena);
+
+	while (adopt_parser_next(&opt, &parser))
+		cl_assert_equal_i(ADOPT_STATUS_OK, opt.status);
+
+	cl_assert_equal_i(3, includes.len);
+	cl_assert_equal_p(buf, includes.values);
+	cl_assert_equal_i(sizeof(buf), arena.len);
+	cl_assert_equal_s("one", includes.values[0]);
+	cl_assert_equal_s("three", includes.values[1]);
+	cl_assert_equal_s("four", includes.values[2]);
+	cl_assert_equal_p(NULL, includes.values[3]);
+
+	/* An exhausted arena fails the parse */
+	memset(&includes, 0, sizeof(includes));
+	adopt_arena_init(&arena, buf, sizeof(char *) * 3);
+	adopt_parser_init(&parser, specs, args, 4, ADOPT_PARSE_DEFAULT);
+	adopt_parser_set_arena(&parser, &arena);
+
+	cl_assert_equal_i(ADOPT_STATUS_OUT_OF_MEMORY, adopt_parser_next(&opt, &parser));
+	cl_assert_equal_i(0, includes.len);
+}
+
+void test_adopt__parse_copy_values(void)
+{
+	char *name = NULL, *file = NULL, **rest = NULL;
+	char request[] = "--name=foo\0-n\0bar\0baz\0one\0two";
+	char *args[6];
+	char buf[64];
+	adopt_arena arena;
+	adopt_parser parser;
+	adopt_opt opt;
+
+	adopt_spec specs[] = {
+		{ ADOPT_TYPE_VALUE, "name", 'n', &name, 0 },
+		{ ADOPT_TYPE_ARG,   "file",  0,  &file, 0 },
+		{ ADOPT_TYPE_ARGS,  "rest",  0,  &rest, 0 },
+		{ 0 },
+	};
+
+	args[0] = &request[0];
+	args[1] = &request[11];
+	args[2] = &request[14];
+	args[3] = &request[18];
+	args[4] = &request[22];
+	args[5] = &request[26];
+
+	/* Copying without a large enough arena fails */
+	adopt_arena_init(&arena, buf, 2);
+	adopt_parser_init(&parser, specs, args, 6, ADOPT_PARSE_COPY_VALUES);
+	adopt_parser_set_arena(&parser, &arena);
+
+	cl_assert_equal_i(ADOPT_STATUS_OUT_OF_MEMORY, adopt_parser_next(&opt, &parser));
+
+	adopt_arena_init(&arena, buf, sizeof(buf));
+	adopt_parser_init(&parser, specs, args, 6, ADOPT_PARSE_COPY_VALUES);
+	adopt_parser_set_arena(&parser, &arena);
+
+	while (adopt_parser_next(&opt, &parser)) {
+		cl_assert_equal_i(ADOPT_STATUS_OK, opt.status);
+
+		if (opt.spec == &specs[0])
+			cl_assert(opt.value >= buf && opt.value < buf + sizeof(buf));
+	}
+
+	/* The values remain after the arguments are reused */
+	memset(request, 'x', sizeof(request));
+
+	cl_assert_equal_s("bar", name);
+	cl_assert_equal_s("baz", file);
+	cl_assert_equal_s("one", rest[0]);
+	cl_assert_equal_s("two", rest[1]);
+	cl_assert_equal_p(NULL, rest[2]);
+
+	/* Resetting the arena reuses it from the beginning */
+	adopt_arena_reset(&arena);
+	cl_assert_equal_i(0, arena.len);
+}
+
+void test_adopt__parse_copy_slices(void)
+{
+	char request[] = "--name=foobar";
+	adopt_slice slices[] = { { request, 10 } };
+	char buf[16];
+	adopt_arena arena;
+	adopt_parser parser;
+	adopt_opt opt;
+
+	adopt_spec specs[] = {
+		{ ADOPT_TYPE_VALUE, "name", 'n', NULL, 0 },
+		{ 0 },
+	};
+
+	adopt_arena_init(&arena, buf, sizeof(buf));
+	adopt_parser_init_slices(&parser, specs, slices, 1, ADOPT_PARSE_COPY_VALUES);
+	adopt_parser_set_arena(&parser, &arena);
+
+	cl_assert_equal_i(ADOPT_STATUS_OK, adopt_parser_next(&opt, &parser));
+
+	/* The copy of a slice is NUL-terminated */
+	cl_assert_equal_p(buf, opt.value);
+	cl_assert_equal_i(3, opt.value_len);
+	cl_assert_equal_s("foo", opt.value);
+}
+
+void test_adopt__parse_slices_values(void)
+{
+	adopt_values includes = { 0 };
+	char buf[] = "-Ifoo --include=barbaz -I";
+	adopt_slice slices[20];
+	adopt_parser parser;
+	adopt_opt opt;
+	size_t i;
+
+	adopt_spec specs[] = {
+		{ ADOPT_TYPE_VALUES, "include", 'I', &includes, 0 },
+		{ 0 },
+	};
+
+	slices[0].ptr = buf;
+	slices[0].len = 4;
+	slices[1].ptr = &buf[6];
+	slices[1].len = 13;
+	slices[2].ptr = &buf[23];
+	slices[2].len = 2;
+	slices[3].ptr = buf;
+	slices[3].len = 1;
+
+	for (i = 4; i < 20; i++)
+		slices[i] = slices[0];
+
+	adopt_parser_init_slices(&parser, specs, slices, 20, ADOPT_PARSE_DEFAULT);
+
+	while (adopt_parser_next(&opt, &parser))
+		cl_assert_equal_i(ADOPT_STATUS_OK, opt.status);
+
+	/* The values of slices are collected as slices */
+	cl_assert_equal_p(NULL, includes.values);
+	cl_assert_equal_i(19, includes.len);
+	cl_assert(includes.alloc >= 19);
+
+	cl_assert_equal_p(&buf[2], includes.slices[0].ptr);
+	cl_assert_equal_i(2, includes.slices[0].len);
+	cl_assert_equal_p(&buf[16], includes.slices[1].ptr);
+	cl_assert_equal_i(3, includes.slices[1].len);
+	cl_assert_equal_p(buf, includes.slices[2].ptr);
+	cl_assert_equal_i(1, includes.slices[2].len);
+	cl_assert_equal_p(&buf[2], includes.slices[18].ptr);
+
+	free(includes.slices);
+}
+
+void test_adopt__parse_numeric(void)
+{
+	int32_t i32 = 0;
+	uint32_t u32 = 0;
+	int64_t i64 = 0;
+	uint64_t u64 = 0;
+	double d = 0;
+	char *args[] = { "--i32=-2147483648", "-u", "4294967295", "--i64", "-9223372036854775808", "-U18446744073709551615", "--double=-1.5e3" };
+	adopt_parser parser;
+	adopt_opt opt;
+
+	adopt_spec specs[] = {
+		{ ADOPT_TYPE_INT32,  "i32",    'i', &i32, 0 },
+		{ ADOPT_TYPE_UINT32, "u32",    'u', &u32, 0 },
+		{ ADOPT_TYPE_INT64,  "i64",    'I', &i64, 0 },
+		{ ADOPT_TYPE_UINT64, "u64",    'U', &u64, 0 },
+		{ ADOPT_TYPE_DOUBLE, "double", 'd', &d,   0 },
+		{ 0 },
+	};
+
+	adopt_parser_init(&parser, specs, args, 7, ADOPT_PARSE_DEFAULT);
+
+	while (adopt_parser_next(&opt, &parser))
+		cl_assert_equal_i(ADOPT_STATUS_OK, opt.status);
+
+	cl_assert(i32 == INT32_MIN);
+	cl_assert(u32 == UINT32_MAX);
+	cl_assert(i64 == INT64_MIN);
+	cl_assert(u64 == UINT64_MAX);
+	cl_assert(d == -1500.0);
+}
+
+static adopt_status_t parse_one(adopt_spec *specs, char *arg)
+{
+	adopt_parser parser;
+	adopt_opt opt;
+
+	adopt_parser_init(&parser, specs, &arg, 1, ADOPT_PARSE_DEFAULT);
+	return adopt_parser_next(&opt, &parser);
+}
+
+void test_adopt__parse_numeric_double(void)
+{
+	double d = 0;
+
+	adopt_spec specs[] = {
+		{ ADOPT_TYPE_DOUBLE, "double", 'd', &d, 0 },
+		{ 0 },
+	};
+
+	cl_assert_equal_i(ADOPT_STATUS_OK, parse_one(specs, "-d0.1"));
+	cl_assert(d == 0.1);
+
+	cl_assert_equal_i(ADOPT_STATUS_OK, parse_one(specs, "-d.5"));
+	cl_assert(d == 0.5);
+
+	cl_assert_equal_i(ADOPT_STATUS_OK, parse_one(specs, "-d3."));
+	cl_assert(d == 3.0);
+
+	cl_assert_equal_i(ADOPT_STATUS_OK, parse_one(specs, "-d2.5E-3"));
+	cl_assert(d == 2.5e-3);
+
+	/* Values that can't be computed exactly are converted by strtod */
+	cl_assert_equal_i(ADOPT_STATUS_OK, parse_one(specs, "-d1.7976931348623157e308"));
+	cl_assert(d == 1.7976931348623157e308);
+
+	cl_assert_equal_i(ADOPT_STATUS_OK, parse_one(specs, "-d12345678901234567890.5"));
+	cl_assert(d == 12345678901234567890.5);
+
+	cl_assert_equal_i(ADOPT_STATUS_VALUE_OUT_OF_RANGE, parse_one(specs, "-d1e400"));
+	cl_assert_equal_i(ADOPT_STATUS_MISSING_VALUE, parse_one(specs, "-d"));
+	cl_assert_equal_i(ADOPT_STATUS_INVALID_VALUE, parse_one(specs, "-d."));
+	cl_assert_equal_i(ADOPT_STATUS_INVALID_VALUE, parse_one(specs, "-d1e"));
+	cl_assert_equal_i(ADOPT_STATUS_INVALID_VALUE, parse_one(specs, "-dinf"));
+	cl_assert_equal_i(ADOPT_STATUS_INVALID_VALUE, parse_one(specs, "-d1,5"));
+}
+
+void test_adopt__parse_numeric_invalid(void)
+{
+	int32_t i32 = 42;
+	uint32_t u32 = 42;
+
+	adopt_spec specs[] = {
+		{ ADOPT_TYPE_INT32,  "i32", 'i', &i32, 0 },
+		{ ADOPT_TYPE_UINT32, "u32", 'u', &u32, 0 },
+		{ 0 },
+	};
+
+	cl_assert_equal_i(ADOPT_STATUS_VALUE_OUT_OF_RANGE, parse_one(specs, "--i32=2147483648"));
+	cl_assert_equal_i(ADOPT_STATUS_VALUE_OUT_OF_RANGE, parse_one(specs, "--i32=-2147483649"));
+	cl_assert_equal_i(ADOPT_STATUS_VALUE_OUT_OF_RANGE, parse_one(specs, "--u32=4294967296"));
+	cl_assert_equal_i(ADOPT_STATUS_VALUE_OUT_OF_RANGE, parse_one(specs, "--u32=-1"));
+	cl_assert_equal_i(ADOPT_STATUS_VALUE_OUT_OF_RANGE, parse_one(specs, "--u32=99999999999999999999999"));
+	cl_assert_equal_i(ADOPT_STATUS_INVALID_VALUE, parse_one(specs, "--i32=-"));
+	cl_assert_equal_i(ADOPT_STATUS_INVALID_VALUE, parse_one(specs, "--i32=12abc"));
+	cl_assert_equal_i(ADOPT_STATUS_INVALID_VALUE, parse_one(specs, "--i32= 12"));
+	cl_assert_equal_i(ADOPT_STATUS_INVALID_VALUE, parse_one(specs, "-u99999999999999999999999x"));
+	cl_assert_equal_i(ADOPT_STATUS_MISSING_VALUE, parse_one(specs, "-u"));
+
+	/* The values are not modified when they can't be converted */
+	cl_assert_equal_i(42, i32);
+	cl_assert_equal_i(42, u32);
+
+	cl_assert_equal_i(ADOPT_STATUS_OK, parse_one(specs, "-i+17"));
+	cl_assert_equal_i(17, i32);
+}
+
+void test_adopt__parse_units(void)
+{
+	uint64_t size = 0, duration = 0, ratio = 0;
+	char *args[] = { "--size=512M", "-d", "250ms", "-r0.5%" };
+	adopt_parser parser;
+	adopt_opt opt;
+
+	adopt_spec specs[] = {
+		{ ADOPT_TYPE_SIZE,     "size",     's', &size,     0 },
+		{ ADOPT_TYPE_DURATION, "duration", 'd', &duration, 0 },
+		{ ADOPT_TYPE_RATIO,    "ratio",    'r', &ratio,    0 },
+		{ 0 },
+	};
+
+	adopt_parser_init(&parser, specs, args, 4, ADOPT_PARSE_DEFAULT);
+
+	while (adopt_parser_next(&opt, &parser))
+		cl_assert_equal_i(ADOPT_STATUS_OK, opt.status);
+
+	cl_assert(size == 512 * 1024 * 1024);
+	cl_assert(duration == 250000000);
+	cl_assert(ratio == 5000);
+
+	cl_assert_equal_i(ADOPT_STATUS_OK, parse_one(specs, "-s4096"));
+	cl_assert(size == 4096);
+	cl_assert_equal_i(ADOPT_STATUS_OK, parse_one(specs, "-s1.5gib"));
+	cl_assert(size == 1536ull * 1024 * 1024);
+	cl_assert_equal_i(ADOPT_STATUS_OK, parse_one(specs, "-s15.5EiB"));
+	cl_assert(size == 31ull << 59);
+
+	cl_assert_equal_i(ADOPT_STATUS_OK, parse_one(specs, "-d2"));
+	cl_assert(duration == 2000000000);
+	cl_assert_equal_i(ADOPT_STATUS_OK, parse_one(specs, "-d1.5h"));
+	cl_assert(duration == 5400000000000ull);
+	cl_assert_equal_i(ADOPT_STATUS_OK, parse_one(specs, "-d0.0000000019s"));
+	cl_assert(duration == 1);
+
+	cl_assert_equal_i(ADOPT_STATUS_OK, parse_one(specs, "-r.25"));
+	cl_assert(ratio == 250000);
+	cl_assert_equal_i(ADOPT_STATUS_OK, parse_one(specs, "-r12ppm"));
+	cl_assert(ratio == 12);
+}
+
+void test_adopt__parse_units_invalid(void)
+{
+	uint64_t size = 42, duration = 42;
+
+	adopt_spec specs[] = {
+		{ ADOPT_TYPE_SIZE,     "size",     's', &size,     0 },
+		{ ADOPT_TYPE_DURATION, "duration", 'd', &duration, 0 },
+		{ 0 },
+	};
+
+	cl_assert_equal_i(ADOPT_STATUS_UNKNOWN_UNIT, parse_one(specs, "-s5q"));
+	cl_assert_equal_i(ADOPT_STATUS_UNKNOWN_UNIT, parse_one(specs, "-s5 M"));
+	cl_assert_equal_i(ADOPT_STATUS_UNKNOWN_UNIT, parse_one(specs, "-d5MS"));
+	cl_assert_equal_i(ADOPT_STATUS_UNKNOWN_UNIT, parse_one(specs, "-d5sec"));
+	cl_assert_equal_i(ADOPT_STATUS_INVALID_VALUE, parse_one(specs, "-dms"));
+	cl_assert_equal_i(ADOPT_STATUS_INVALID_VALUE, parse_one(specs, "-d-5s"));
+	cl_assert_equal_i(ADOPT_STATUS_VALUE_OUT_OF_RANGE, parse_one(specs, "-s16E"));
+	cl_assert_equal_i(ADOPT_STATUS_VALUE_OUT_OF_RANGE, parse_one(specs, "-s18446744073709551616"));
+	cl_assert_equal_i(ADOPT_STATUS_VALUE_OUT_OF_RANGE, parse_one(specs, "-d99999999999999999999ns"));
+
+	cl_assert(size == 42);
+	cl_assert(duration == 42);
+}
+
+enum { MODE_FAST = 1, MODE_SAFE, MODE_PARANOID };
+enum { FORMAT_JSON = 1, FORMAT_CSV, FORMAT_TSV };
+
+static const adopt_enum_value modes[] = {
+	{ "fast",     MODE_FAST },
+	{ "safe",     MODE_SAFE },
+	{ "paranoid", MODE_PARANOID },
+	{ NULL }
+};
+
+static const adopt_enum_value formats[] = {
+	{ "json", FORMAT_JSON },
+	{ "csv",  FORMAT_CSV },
+	{ "tsv",  FORMAT_TSV },
+	{ "safe", 0 },
+	{ NULL }
+};
+
+void test_adopt__parse_enum(void)
+{
+	int mode = 0, format = 0;
+	char *args[] = { "--mode=paranoid", "-f", "csv" };
+	adopt_value results[3];
+	adopt_index *index;
+	adopt_parser parser;
+	adopt_opt opt;
+
+	adopt_spec specs[] = {
+		{ ADOPT_TYPE_ENUM, "mode",   'm', &mode,   0, 0, NULL, NULL, modes },
+		{ ADOPT_TYPE_ENUM, "format", 'f', &format, 0, 0, NULL, NULL, formats },
+		{ 0 },
+	};
+
+	adopt_parser_init(&parser, specs, args, 3, ADOPT_PARSE_DEFAULT);
+
+	while (adopt_parser_next(&opt, &parser))
+		cl_assert_equal_i(ADOPT_STATUS_OK, opt.status);
+
+	cl_assert_equal_i(MODE_PARANOID, mode);
+	cl_assert_equal_i(FORMAT_CSV, format);
+
+	/* With an index, the values are found in its hash table */
+	cl_must_pass(adopt_spec_compile(&index, specs));
+	memset(results, 0, sizeof(results));
+
+	cl_assert_equal_i(ADOPT_STATUS_DONE,
+		adopt_parse_index(&opt, index, results, args, 3, ADOPT_PARSE_DEFAULT));
+	cl_assert_equal_i(MODE_PARANOID, results[0].i);
+	cl_assert_equal_i(FORMAT_CSV, results[1].i);
+
+	/* A value is only matched against its own spec's values */
+	args[0] = "--mode=json";
+	cl_assert_equal_i(ADOPT_STATUS_UNKNOWN_VALUE,
+		adopt_parse_index(&opt, index, results, args, 3, ADOPT_PARSE_DEFAULT));
+	cl_assert_equal_s("json", opt.value);
+
+	args[0] = "--mode=saf";
+	cl_assert_equal_i(ADOPT_STATUS_UNKNOWN_VALUE,
+		adopt_parse_index(&opt, index, results, args, 3, ADOPT_PARSE_DEFAULT));
+
+	args[0] = "--mode=safe";
+	cl_assert_equal_i(ADOPT_STATUS_DONE,
+		adopt_parse_index(&opt, index, results, args, 3, ADOPT_PARSE_DEFAULT));
+	cl_assert_equal_i(MODE_SAFE, results[0].i);
+
+	adopt_index_free(index);
+}
+
+void test_adopt__parse_enum_unknown(void)
+{
+	int mode = 0;
+	char *args[] = { "-mslow" };
+	char buf[128];
+	FILE *file;
+	adopt_parser parser;
+	adopt_opt opt;
+
+	adopt_spec specs[] = {
+		{ ADOPT_TYPE_ENUM, "mode", 'm', &mode, 0, 0, NULL, NULL, modes },
+		{ 0 },
+	};
+
+	adopt_parser_init(&parser, specs, args, 1, ADOPT_PARSE_DEFAULT);
+	cl_assert_equal_i(ADOPT_STATUS_UNKNOWN_VALUE, adopt_parser_next(&opt, &parser));
+	cl_assert_equal_i(0, mode);
+
+	cl_assert((file = tmpfile()) != NULL);
+	cl_assert(adopt_status_fprint(file, "test", &opt) >= 0);
+
+	rewind(file);
+	cl_assert(fgets(buf, sizeof(buf), file) != NULL);
+	fclose(file);
+
+	cl_assert_equal_s("test: unknown value for argument '-m': slow (expected one of: fast, safe, paranoid)\n", buf);
+}
+
+#define FEATURE_A (1 << 0)
+#define FEATURE_B (1 << 1)
+#define FEATURE_C (1 << 2)
+
+static const adopt_enum_value features[] = {
+	{ "a", FEATURE_A },
+	{ "b", FEATURE_B },
+	{ "c", FEATURE_C },
+	{ NULL }
+};
+
+void test_adopt__parse_list(void)
+{
+	adopt_list names = { 0 };
+	adopt_int_list ids = { 0 };
+	int mask = 0;
+	char *args[] = { "--names=one,two,,three", "-i1,-2,3", "--features=c:a", "-n", "four" };
+	adopt_parser parser;
+	adopt_opt opt;
+
+	adopt_spec specs[] = {
+		{ ADOPT_TYPE_LIST,     "names",    'n', &names, 0 },
+		{ ADOPT_TYPE_INT_LIST, "ids",      'i', &ids,   0 },
+		{ ADOPT_TYPE_BITMASK,  "features", 'f', &mask,  ':', 0, NULL, NULL, features },
+		{ 0 },
+	};
+
+	adopt_parser_init(&parser, specs, args, 5, ADOPT_PARSE_DEFAULT);
+
+	while (adopt_parser_next(&opt, &parser))
+		cl_assert_equal_i(ADOPT_STATUS_OK, opt.status);
+
+	/* Items point into the arguments, and are appended */
+	cl_assert_equal_i(5, names.len);
+	cl_assert_equal_p(&args[0][8], names.items[0].ptr);
+	cl_assert_equal_i(3, names.items[0].len);
+	cl_assert_equal_p(&args[0][12], names.items[1].ptr);
+	cl_assert_equal_i(3, names.items[1].len);
+	cl_assert_equal_i(0, names.items[2].len);
+	cl_assert_equal_p(&args[0][17], names.items[3].ptr);
+	cl_assert_equal_i(5, names.items[3].len);
+	cl_assert_equal_p(args[4], names.items[4].ptr);
+	cl_assert_equal_i(4, names.items[4].len);
+
+	cl_assert_equal_i(3, ids.len);
+	cl_assert(ids.items[0] == 1);
+	cl_assert(ids.items[1] == -2);
+	cl_assert(ids.items[2] == 3);
+
+	cl_assert_equal_i(FEATURE_A | FEATURE_C, mask);
+
+	free(names.items);
+	free(ids.items);
+}
+
+void test_adopt__parse_list_long(void)
+{
+	adopt_int_list ids = { 0 };
+	char value[8192 + 6], *arg = value;
+	adopt_parser parser;
+	adopt_opt opt;
+	size_t i, len = 6;
+
+	adopt_spec specs[] = {
+		{ ADOPT_TYPE_INT_LIST, "ids", 'i', &ids, 0 },
+		{ 0 },
+	};
+
+	/* A long list, with items at every alignment */
+	memcpy(value, "--ids=", 6);
+
+	for (i = 0; i < 1600; i++)
+		len += sprintf(&value[len], "%s%d", i ? "," : "", (int)i);
+
+	adopt_parser_init(&parser, specs, &arg, 1, ADOPT_PARSE_DEFAULT);
+	cl_assert_equal_i(ADOPT_STATUS_OK, adopt_parser_next(&opt, &parser));
+
+	cl_assert_equal_i(1600, ids.len);
+
+	for (i = 0; i < 1600; i++)
+		cl_assert(ids.items[i] == (int64_t)i);
+
+	free(ids.items);
+}
+
+void test_adopt__parse_list_invalid(void)
+{
+	adopt_int_list ids = { 0 };
+	int mask = FEATURE_B;
+	adopt_index *index;
+	adopt_value results[2];
+	char *args[] = { "-fa,d" };
+	adopt_opt opt;
+
+	adopt_spec specs[] = {
+		{ ADOPT_TYPE_INT_LIST, "ids",      'i', &ids,  0 },
+		{ ADOPT_TYPE_BITMASK,  "features", 'f', &mask, 0, 0, NULL, NULL, features },
+		{ 0 },
+	};
+
+	cl_assert_equal_i(ADOPT_STATUS_OK, parse_one(specs, "-i1,2"));
+	cl_assert_equal_i(ADOPT_STATUS_INVALID_VALUE, parse_one(specs, "-i3,x"));
+	cl_assert_equal_i(ADOPT_STATUS_INVALID_VALUE, parse_one(specs, "-i4,"));
+	cl_assert_equal_i(ADOPT_STATUS_VALUE_OUT_OF_RANGE, parse_one(specs, "-i5,9223372036854775808"));
+
+	/* The items of a value that fails are not added */
+	cl_assert_equal_i(2, ids.len);
+	cl_assert(ids.items[0] == 1 && ids.items[1] == 2);
+	free(ids.items);
+
+	cl_assert_equal_i(ADOPT_STATUS_OK, parse_one(specs, "-fc"));
+	cl_assert_equal_i(ADOPT_STATUS_UNKNOWN_VALUE, parse_one(specs, "-fa,d"));
+	cl_assert_equal_i(FEATURE_B | FEATURE_C, mask);
+
+	/* With an index, the flags are found in its hash table */
+	cl_must_pass(adopt_spec_compile(&index, specs));
+	memset(results, 0, sizeof(results));
+
+	cl_assert_equal_i(ADOPT_STATUS_UNKNOWN_VALUE,
+		adopt_parse_index(&opt, index, results, args, 1, ADOPT_PARSE_DEFAULT));
+
+	args[0] = "-fa,b";
+	cl_assert_equal_i(ADOPT_STATUS_DONE,
+		adopt_parse_index(&opt, index, results, args, 1, ADOPT_PARSE_DEFAULT));
+	cl_assert_equal_i(FEATURE_A | FEATURE_B, results[1].i);
+
+	adopt_index_free(index);
+}
+
+enum { CACHE_NONE = 1, CACHE_LOOSE };
+
+static const adopt_enum_value caches[] = {
+	{ "none",  CACHE_NONE },
+	{ "loose", CACHE_LOOSE },
+	{ NULL }
+};
+
+void test_adopt__parse_subopts(void)
+{
+	int ro = 0, cache = 0, verbose = 0;
+	uint32_t uid = 0;
+	adopt_slice label = { 0 };
+	char *args[] = { "-oro,uid=1000,cache=loose,label=a=b", "--options=verbose:verbose" };
+	adopt_value results[2], mount[5], options[5];
+	adopt_index *index;
+	adopt_parser parser;
+	adopt_opt opt;
+
+	adopt_spec subopts[] = {
+		{ ADOPT_TYPE_BOOL,        "ro",      0, &ro,      0 },
+		{ ADOPT_TYPE_UINT32,      "uid",     0, &uid,     0 },
+		{ ADOPT_TYPE_ENUM,        "cache",   0, &cache,   0, 0, NULL, NULL, caches },
+		{ ADOPT_TYPE_VALUE,       "label",   0, &label,   0 },
+		{ ADOPT_TYPE_ACCUMULATOR, "verbose", 0, &verbose, 0 },
+		{ 0 },
+	};
+
+	adopt_spec specs[] = {
+		{ ADOPT_TYPE_SUBOPTS, "mount",   'o', NULL, 0,   0, NULL, NULL, subopts },
+		{ ADOPT_TYPE_SUBOPTS, "options",  0,  NULL, ':', 0, NULL, NULL, subopts },
+		{ 0 },
+	};
+
+	adopt_parser_init(&parser, specs, args, 2, ADOPT_PARSE_DEFAULT);
+
+	while (adopt_parser_next(&opt, &parser))
+		cl_assert_equal_i(ADOPT_STATUS_OK, opt.status);
+
+	cl_assert_equal_i(1, ro);
+	cl_assert(uid == 1000);
+	cl_assert_equal_i(CACHE_LOOSE, cache);
+	cl_assert_equal_i(2, verbose);
+
+	/* Values are slices of the argument, split at the first '=' */
+	cl_assert_equal_p(&args[0][32], label.ptr);
+	cl_assert_equal_i(3, label.len);
+
+	/*
+	 * With an index, the sub-options are found in its hash table;
+	 * with a result block, they're stored in the caller's blocks,
+	 * not their shared pointers.
+	 */
+	cl_must_pass(adopt_spec_compile(&index, specs));
+
+	ro = 0;
+	memset(mount, 0, sizeof(mount));
+	memset(options, 0, sizeof(options));
+	results[0].sub = mount;
+	results[1].sub = options;
+
+	cl_assert_equal_i(ADOPT_STATUS_DONE,
+		adopt_parse_index(&opt, index, results, args, 2, ADOPT_PARSE_DEFAULT));
+	cl_assert_equal_i(0, ro);
+	cl_assert_equal_i(2, verbose);
+
+	cl_assert_equal_i(1, mount[0].i);
+	cl_assert(mount[1].u32 == 1000);
+	cl_assert_equal_i(CACHE_LOOSE, mount[2].i);
+	cl_assert_equal_p(&args[0][32], mount[3].slice.ptr);
+	cl_assert_equal_i(3, mount[3].slice.len);
+	cl_assert_equal_i(0, mount[4].i);
+	cl_assert_equal_i(2, options[4].i);
+
+	/* Without a block for them, the sub-options are only validated */
+	args[0] = "-ocache=none";
+	results[0].sub = NULL;
+	cl_assert_equal_i(ADOPT_STATUS_DONE,
+		adopt_parse_index(&opt, index, results, args, 1, ADOPT_PARSE_DEFAULT));
+	cl_assert_equal_i(CACHE_LOOSE, cache);
+	cl_assert_equal_i(CACHE_LOOSE, mount[2].i);
+
+	args[0] = "-orw";
+	cl_assert_equal_i(ADOPT_STATUS_UNKNOWN_VALUE,
+		adopt_parse_index(&opt, index, results, args, 1, ADOPT_PARSE_DEFAULT));
+
+	args[0] = "-ocache=tight";
+	cl_assert_equal_i(ADOPT_STATUS_UNKNOWN_VALUE,
+		adopt_parse_index(&opt, index, results, args, 1, ADOPT_PARSE_DEFAULT));
+
+	adopt_index_free(index);
+
+	cl_assert_equal_i(ADOPT_STATUS_MISSING_VALUE, parse_one(specs, "-ouid"));
+	cl_assert_equal_i(ADOPT_STATUS_INVALID_VALUE, parse_one(specs, "-oro=1"));
+	cl_assert_equal_i(ADOPT_STATUS_VALUE_OUT_OF_RANGE, parse_one(specs, "-ouid=-1"));
+	cl_assert_equal_i(ADOPT_STATUS_UNKNOWN_VALUE, parse_one(specs, "-oro,,uid=1"));
+}
+
+void test_adopt__parse_subopts_invalid_type(void)
+{
+	adopt_values values = { 0 };
+	adopt_index *index;
+
+	adopt_spec subopts[] = {
+		{ ADOPT_TYPE_BOOL,   "ro",      0, NULL,    0 },
+		{ ADOPT_TYPE_VALUES, "include", 0, &values, 0 },
+		{ 0 },
+	};
+
+	adopt_spec nested[] = {
+		{ ADOPT_TYPE_SUBOPTS, "inner", 0, NULL, 0, 0, NULL, NULL, subopts },
+		{ 0 },
+	};
+
+	adopt_spec specs[] = {
+		{ ADOPT_TYPE_SUBOPTS, "mount", 'o', NULL, 0, 0, NULL, NULL, subopts },
+		{ ADOPT_TYPE_SUBOPTS, "outer", 'x', NULL, 0, 0, NULL, NULL, nested },
+		{ 0 },
+	};
+
+	/* Sub-options that can't be stored from an item are an error */
+	cl_assert_equal_i(ADOPT_STATUS_OK, parse_one(specs, "-oro"));
+	cl_assert_equal_i(ADOPT_STATUS_INVALID_VALUE, parse_one(specs, "-oinclude=a"));
+	cl_assert_equal_i(ADOPT_STATUS_INVALID_VALUE, parse_one(specs, "-xinner"));
+	cl_assert_equal_i(0, values.len);
+
+	cl_must_fail(adopt_spec_compile(&index, specs));
+	cl_assert_equal_p(NULL, index);
+}
+
+void test_adopt__parse_key_values(void)
+{
+	adopt_key_values defines = { 0 };
+	char *args[] = { "-DNAME=value", "-D", "EMPTY=", "--define=FLAG", "-DA=b=c" };
+	adopt_parser parser;
+	adopt_opt opt;
+
+	adopt_spec specs[] = {
+		{ ADOPT_TYPE_KEY_VALUES, "define", 'D', &defines, 0 },
+		{ 0 },
+	};
+
+	adopt_parser_init(&parser, specs, args, 5, ADOPT_PARSE_DEFAULT);
+
+	while (adopt_parser_next(&opt, &parser))
+		cl_assert_equal_i(ADOPT_STATUS_OK, opt.status);
+
+	/* The definitions are counted ahead, and allocated once */
+	cl_assert_equal_i(4, defines.len);
+	cl_assert_equal_i(4, defines.alloc);
+
+	cl_assert_equal_p(&args[0][2], defines.items[0].key.ptr);
+	cl_assert_equal_i(4, defines.items[0].key.len);
+	cl_assert_equal_p(&args[0][7], defines.items[0].value.ptr);
+	cl_assert_equal_i(5, defines.items[0].value.len);
+
+	cl_assert_equal_i(5, defines.items[1].key.len);
+	cl_assert_equal_p(&args[2][6], defines.items[1].value.ptr);
+	cl_assert_equal_i(0, defines.items[1].value.len);
+
+	cl_assert_equal_i(4, defines.items[2].key.len);
+	cl_assert_equal_p(NULL, defines.items[2].value.ptr);
+
+	cl_assert_equal_i(1, defines.items[3].key.len);
+	cl_assert_equal_i(3, defines.items[3].value.len);
+
+	free(defines.items);
+}
+
+void test_adopt__parse_words(void)
+{
+	adopt_words point = { 0 }, size = { 0 };
+	char *args[] = { "--point", "1", "-2", "3", "-s", "--w", "--h" };
+	adopt_parser parser;
+	adopt_opt opt;
+
+	adopt_spec specs[] = {
+		{ ADOPT_TYPE_WORDS, "point", 'p', &point, 3 },
+		{ ADOPT_TYPE_WORDS, "size",  's', &size,  2 },
+		{ 0 },
+	};
+
+	adopt_parser_init(&parser, specs, args, 7, ADOPT_PARSE_DEFAULT);
+
+	while (adopt_parser_next(&opt, &parser))
+		cl_assert_equal_i(ADOPT_STATUS_OK, opt.status);
+
+	/* Words are taken as given, even when they look like options */
+	cl_assert_equal_i(3, point.len);
+	cl_assert_equal_p(&args[1], point.args);
+	cl_assert_equal_s("-2", point.args[1]);
+
+	cl_assert_equal_i(2, size.len);
+	cl_assert_equal_p(&args[5], size.args);
+}
+
+void test_adopt__parse_words_until(void)
+{
+	adopt_words exec = { 0 }, cmd = { 0 };
+	int verbose = 0;
+	char *args[] = { "--exec", "rm", "-v", "{}", ";", "-v",
+		"-c", "echo", ";", "done", "-v" };
+	adopt_parser parser;
+	adopt_opt opt;
+
+	adopt_spec specs[] = {
+		{ ADOPT_TYPE_WORDS_UNTIL, "exec", 0,  &exec,    0 },
+		{ ADOPT_TYPE_WORDS_UNTIL, "cmd", 'c', &cmd,     0, 0, NULL, NULL, "done" },
+		{ ADOPT_TYPE_ACCUMULATOR, NULL,  'v', &verbose, 0 },
+		{ 0 },
+	};
+
+	adopt_parser_init(&parser, specs, args, 11, ADOPT_PARSE_DEFAULT);
+
+	while (adopt_parser_next(&opt, &parser))
+		cl_assert_equal_i(ADOPT_STATUS_OK, opt.status);
+
+	/* The terminator is consumed, and not part of the words */
+	cl_assert_equal_i(3, exec.len);
+	cl_assert_equal_p(&args[1], exec.args);
+	cl_assert_equal_s("-v", exec.args[1]);
+
+	cl_assert_equal_i(2, cmd.len);
+	cl_assert_equal_s("echo", cmd.args[0]);
+	cl_assert_equal_s(";", cmd.args[1]);
+
+	cl_assert_equal_i(2, verbose);
+}
+
+void test_adopt__parse_words_gnustyle(void)
+{
+	adopt_words exec = { 0 };
+	int verbose = 0;
+	char **argz = NULL;
+	char *args[] = { "one", "--exec", "rm", "two", ";", "three", "-v" };
+	adopt_opt result;
+
+	adopt_spec specs[] = {
+		{ ADOPT_TYPE_WORDS_UNTIL, "exec", 0,  &exec,    0 },
+		{ ADOPT_TYPE_SWITCH,      NULL,  'v', &verbose, 1 },
+		{ ADOPT_TYPE_ARGS,        "argz", 0,  &argz,    0 },
+		{ 0 },
+	};
+
+	cl_must_pass(adopt_parse(&result, specs, args, 7, ADOPT_PARSE_FORCE_GNU));
+
+	cl_assert_equal_i(ADOPT_STATUS_DONE, result.status);
+	cl_assert_equal_i(1, verbose);
+
+	/* The words follow the options that were sorted ahead of them */
+	cl_assert_equal_s("--exec", args[0]);
+	cl_assert_equal_i(2, exec.len);
+	cl_assert_equal_p(&args[1], exec.args);
+	cl_assert_equal_s("rm", exec.args[0]);
+	cl_assert_equal_s("two", exec.args[1]);
+
+	cl_assert_equal_s("one", argz[0]);
+	cl_assert_equal_s("three", argz[1]);
+}
+
+void test_adopt__parse_words_missing(void)
+{
+	adopt_words point = { 0 }, exec = { 0 };
+	char *too_few[] = { "--point", "1", "2" };
+	char *unterminated[] = { "--exec", "rm", "{}" };
+	char *attached[] = { "-p1", "2", "3" };
+	adopt_parser parser;
+	adopt_opt opt;
+
+	adopt_spec specs[] = {
+		{ ADOPT_TYPE_WORDS,       "point", 'p', &point, 3 },
+		{ ADOPT_TYPE_WORDS_UNTIL, "exec",   0,  &exec,  0 },
+		{ 0 },
+	};
+
+	adopt_parser_init(&parser, specs, too_few, 3, ADOPT_PARSE_DEFAULT);
+	cl_assert_equal_i(ADOPT_STATUS_MISSING_VALUE, adopt_parser_next(&opt, &parser));
+	cl_assert_equal_i(ADOPT_STATUS_DONE, adopt_parser_next(&opt, &parser));
+
+	adopt_parser_init(&parser, specs, unterminated, 3, ADOPT_PARSE_DEFAULT);
+	cl_assert_equal_i(ADOPT_STATUS_MISSING_VALUE, adopt_parser_next(&opt, &parser));
+	cl_assert_equal_i(ADOPT_STATUS_DONE, adopt_parser_next(&opt, &parser));
+
+	adopt_parser_init(&parser, specs, attached, 3, ADOPT_PARSE_DEFAULT);
+	cl_assert_equal_i(ADOPT_STATUS_INVALID_VALUE, adopt_parser_next(&opt, &parser));
+	cl_assert_equal_s("1", opt.value);
+
+	cl_assert_equal_i(0, point.len);
+	cl_assert_equal_i(0, exec.len);
+}
+
+typedef struct {
+	int verbose;
+	char *name;
+	int64_t depth;
+	int ro;
+	uint32_t uid;
+	adopt_values includes;
+} test_config;
+
+static const test_config test_config_defaults = {
+	1, "default", 10, 0, 0, { 0 }
+};
+
+static adopt_spec test_config_mount[] = {
+	{ ADOPT_TYPE_BOOL,   "ro",  0, ADOPT_OFFSET(test_config, ro),  0 },
+	{ ADOPT_TYPE_UINT32, "uid", 0, ADOPT_OFFSET(test_config, uid), 0 },
+	{ 0 },
+};
+
+static adopt_spec test_config_specs[] = {
+	{ ADOPT_TYPE_ACCUMULATOR, "verbose", 'v', ADOPT_OFFSET(test_config, verbose), 0 },
+	{ ADOPT_TYPE_VALUE,       "name",    'n', ADOPT_OFFSET(test_config, name),    0 },
+	{ ADOPT_TYPE_INT64,       "depth",   'd', ADOPT_OFFSET(test_config, depth),   0 },
+	{ ADOPT_TYPE_SUBOPTS,     "mount",   'o', NULL, 0, 0, NULL, NULL, test_config_mount },
+	{ ADOPT_TYPE_VALUES,      "include", 'I', ADOPT_OFFSET(test_config, includes), 0 },
+	{ 0 },
+};
+
+void test_adopt__parse_config(void)
+{
+	test_config one, two;
+	char *one_args[] = { "-vv", "--depth=3", "-oro,uid=1000", "-Ia", "-Ib" };
+	char *two_args[] = { "--name", "two" };
+	adopt_opt opt;
+
+	memset(&one, 0xff, sizeof(one));
+	memset(&two, 0xff, sizeof(two));
+
+	cl_assert_equal_i(ADOPT_STATUS_DONE, adopt_parse_config(&opt,
+		test_config_specs, &one, &test_config_defaults, sizeof(test_config),
+		one_args, 5, ADOPT_PARSE_DEFAULT));
+	cl_assert_equal_i(ADOPT_STATUS_DONE, adopt_parse_config(&opt,
+		test_config_specs, &two, &test_config_defaults, sizeof(test_config),
+		two_args, 2, ADOPT_PARSE_DEFAULT));
+
+	/* The defaults are applied to each, and the specs are untouched */
+	cl_assert_equal_i(3, one.verbose);
+	cl_assert_equal_s("default", one.name);
+	cl_assert(one.depth == 3);
+	cl_assert_equal_i(1, one.ro);
+	cl_assert(one.uid == 1000);
+	cl_assert_equal_i(2, one.includes.len);
+	cl_assert_equal_s("b", one.includes.values[1]);
+
+	cl_assert_equal_i(1, two.verbose);
+	cl_assert_equal_s("two", two.name);
+	cl_assert(two.depth == 10);
+	cl_assert_equal_i(0, two.ro);
+	cl_assert_equal_i(0, two.includes.len);
+
+	cl_assert(test_config_specs[0].value == ADOPT_OFFSET(test_config, verbose));
+
+	free(one.includes.values);
+}
+
+void test_adopt__parse_config_batch(void)
+{
+	adopt_index *index;
+	adopt_batch batch[100];
+	test_config configs[100];
+	char *args[] = { "-v", "--name=batch", "-o", "uid=7" };
+	size_t i;
+
+	cl_must_pass(adopt_spec_compile(&index, test_config_specs));
+
+	memset(batch, 0, sizeof(batch));
+
+	for (i = 0; i < 100; i++) {
+		memcpy(&configs[i], &test_config_defaults, sizeof(test_config));
+
+		batch[i].args = args;
+		batch[i].args_len = (i % 2) ? 4 : 2;
+		batch[i].config = &configs[i];
+	}
+
+	cl_assert_equal_i(0, adopt_parse_batch(index, batch, 100, ADOPT_PARSE_DEFAULT, 4));
+
+	for (i = 0; i < 100; i++) {
+		cl_assert_equal_i(ADOPT_STATUS_DONE, batch[i].opt.status);
+		cl_assert_equal_i(2, configs[i].verbose);
+		cl_assert_equal_s("batch", configs[i].name);
+		cl_assert(configs[i].uid == ((i % 2) ? 7 : 0));
+	}
+
+	adopt_index_free(index);
+}